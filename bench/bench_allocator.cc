@@ -0,0 +1,50 @@
+#include "rangemap.h"
+#include "bench_utils.h"
+#include "benchmark/benchmark.h"
+#include <memory_resource>
+
+namespace rangemap {
+
+namespace {
+
+void BM_AllocDefault(benchmark::State &state) {
+  uint64_t count = state.range(0);
+  for (auto _ : state) {
+    RangeMap map;
+    Fill(&map, count);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+void BM_AllocReserve(benchmark::State &state) {
+  uint64_t count = state.range(0);
+  for (auto _ : state) {
+    RangeMap map;
+    map.Reserve(count);
+    Fill(&map, count);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+// Pool chunks come from a monotonic arena, nothing is freed before the end
+void BM_AllocReserveMonotonic(benchmark::State &state) {
+  uint64_t count = state.range(0);
+  for (auto _ : state) {
+    std::pmr::monotonic_buffer_resource arena;
+    RangeMap map(&arena);
+    map.Reserve(count);
+    Fill(&map, count);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+}  // namespace
+
+BENCHMARK(BM_AllocDefault)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_AllocReserve)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_AllocReserveMonotonic)->Range(1 << 10, 1 << 20);
+
+}  // namespace rangemap
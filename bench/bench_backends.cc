@@ -0,0 +1,344 @@
+#include "flat_rangemap.h"
+#include "frozen_rangemap.h"
+#include "loader.h"
+#include "mapped_rangemap.h"
+#include "persistent_rangemap.h"
+#include "rangemap.h"
+#include "segmented_rangemap.h"
+#include "bench_utils.h"
+#include "benchmark/benchmark.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace rangemap {
+
+namespace {
+
+template <class Map>
+void BM_AddRangeSequential(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  for (auto _ : state) {
+    Map map;
+    Fill(&map, count);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+void BM_AddRangesBulk(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  std::vector<RangeMap::RangeSpec> specs;
+  specs.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    specs.push_back({i % 8, i * kStride, kStride / 2});
+  }
+  for (auto _ : state) {
+    RangeMap map;
+    map.AddRanges(specs, true);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+// 64 feeds of range(0) / 64 random ranges each built with range(1)
+// threads, feeds overlap each other
+void BM_ParallelBuild(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const size_t kFeeds = 64;
+  std::vector<std::vector<RangeMap::RangeSpec>> feeds(kFeeds);
+  auto addrs = RandomAddrs(count, count);
+  for (uint64_t i = 0; i < count; ++i) {
+    feeds[i % kFeeds].push_back({i % 8, addrs[i], kStride / 2});
+  }
+  std::vector<Span<const RangeMap::RangeSpec>> sources(feeds.begin(),
+                                                       feeds.end());
+  for (auto _ : state) {
+    RangeMap map = RangeMap::ParallelBuild(sources, state.range(1));
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+
+// Maps text of range(0) shared objects with 4 mappings each is parsed in
+// 64K chunks and added with one AddRanges call
+void BM_LoadProcMaps(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  std::string text;
+  char line[128];
+  uint64_t addr = 0x7f0000000000;
+  for (uint64_t i = 0; i < count; ++i) {
+    for (const char *perms : {"r--p", "r-xp", "r--p", "rw-p"}) {
+      std::snprintf(line, sizeof(line),
+                    "%lx-%lx %s 00000000 08:01 %lu /usr/lib/libbench%lu.so\n",
+                    addr, addr + 0x2000, perms, i, i);
+      text += line;
+      addr += 0x2000;
+    }
+  }
+  const size_t kChunk = 64 * 1024;
+  for (auto _ : state) {
+    std::vector<RangeMap::RangeSpec> specs;
+    ProcMapsParser parser;
+    auto fn = [&](const ProcMapsParser::Mapping &mapping) {
+      specs.push_back({mapping.inode, mapping.begin,
+                       mapping.end - mapping.begin});
+    };
+    for (size_t pos = 0; pos < text.size(); pos += kChunk) {
+      parser.Feed(text.data() + pos, std::min(kChunk, text.size() - pos), fn);
+    }
+    parser.Finish(fn);
+    RangeMap map;
+    map.AddRanges(specs, true);
+    benchmark::DoNotOptimize(map);
+  }
+  state.SetItemsProcessed(state.iterations() * count * 4);
+}
+
+// Keep the previous version and add one range to a map of range(0)
+// entries: O(1) snapshot of the persistent map vs a full copy
+template <bool is_persistent>
+void BM_SnapshotAddRange(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  PersistentRangeMap persistent;
+  RangeMap map;
+  if (is_persistent) {
+    Fill(&persistent, count);
+  } else {
+    Fill(&map, count);
+  }
+  auto addrs = RandomAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    // Ranges go into gaps between entries
+    uint64_t addr = addrs[i] / kStride * kStride + kStride / 2;
+    if (is_persistent) {
+      PersistentRangeMap old = persistent.Snapshot();
+      persistent.AddRange(9, addr, kStride / 4);
+      benchmark::DoNotOptimize(old);
+    } else {
+      RangeMap old = map;
+      map.AddRange(9, addr, kStride / 4);
+      benchmark::DoNotOptimize(old);
+    }
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <class Map>
+void BM_TryGetEntryRandom(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  Map map;
+  Fill(&map, count);
+  auto addrs = RandomAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    typename Map::range_type type;
+    typename Map::size_type size;
+    benchmark::DoNotOptimize(map.TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+template <class Map>
+void BM_IsRangeCoveredRandom(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  Map map;
+  Fill(&map, count);
+  auto addrs = RandomAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.IsRangeCovered(addrs[i], kStride / 4));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_FrozenTryGetEntryRandom(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  RangeMap map;
+  Fill(&map, count);
+  FrozenRangeMap frozen = map.Freeze();
+  auto addrs = RandomAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    FrozenRangeMap::range_type type;
+    FrozenRangeMap::size_type size;
+    benchmark::DoNotOptimize(frozen.TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes"] = frozen.MemoryUsage();
+}
+
+void BM_MappedTryGetEntryRandom(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  RangeMap map;
+  Fill(&map, count);
+  const std::string path = "/tmp/rangemap_bench.bin";
+  if (!map.SaveTo(path)) {
+    state.SkipWithError("Can't write snapshot");
+    return;
+  }
+  auto mapped = MappedRangeMap::Open(path);
+  auto addrs = RandomAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    MappedRangeMap::range_type type;
+    MappedRangeMap::size_type size;
+    benchmark::DoNotOptimize(mapped->TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+  std::remove(path.c_str());
+}
+
+template <class Map>
+void RunBatch(benchmark::State &state, const Map &map, bool is_sorted) {
+  const uint64_t count = state.range(0);
+  auto addrs = RandomAddrs(count, 4096);
+  if (is_sorted) {
+    std::sort(addrs.begin(), addrs.end());
+  }
+  std::vector<uint64_t> types(addrs.size()), sizes(addrs.size());
+  std::vector<uint64_t> found(BitmaskWords(addrs.size()));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.TryGetEntries(addrs, types, sizes, found));
+  }
+  state.SetItemsProcessed(state.iterations() * addrs.size());
+}
+
+void BM_TryGetEntriesRandom(benchmark::State &state) {
+  RangeMap map;
+  Fill(&map, state.range(0));
+  RunBatch(state, map, false);
+}
+
+void BM_TryGetEntriesSorted(benchmark::State &state) {
+  RangeMap map;
+  Fill(&map, state.range(0));
+  RunBatch(state, map, true);
+}
+
+void BM_FrozenTryGetEntriesRandom(benchmark::State &state) {
+  RangeMap map;
+  Fill(&map, state.range(0));
+  RunBatch(state, map.Freeze(), false);
+}
+
+void BM_FrozenTryGetEntriesSorted(benchmark::State &state) {
+  RangeMap map;
+  Fill(&map, state.range(0));
+  RunBatch(state, map.Freeze(), true);
+}
+
+void BM_TryGetEntryLocal(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  RangeMap map;
+  Fill(&map, count);
+  auto addrs = LocalAddrs(count, 1 << 16);
+  size_t i = 0;
+  for (auto _ : state) {
+    RangeMap::range_type type;
+    RangeMap::size_type size;
+    benchmark::DoNotOptimize(map.TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_CursorTryGetEntryLocal(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  RangeMap map;
+  Fill(&map, count);
+  auto addrs = LocalAddrs(count, 1 << 16);
+  RangeMap::Cursor cursor(map);
+  size_t i = 0;
+  for (auto _ : state) {
+    RangeMap::range_type type;
+    RangeMap::size_type size;
+    benchmark::DoNotOptimize(cursor.TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (addrs.size() - 1);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["misses"] = cursor.MissCount();
+}
+
+// Move a segment of range(0) entries back and forth with Rebase or by
+// removing its ranges and adding them at the new base
+template <bool is_rebase>
+void BM_MoveSegment(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const uint64_t size = count * kStride;
+  SegmentedRangeMap segmented;
+  segmented.AddSegment(0, 0, size);
+  RangeMap map;
+  for (uint64_t i = 0; i < count; ++i) {
+    segmented.AddSegmentRange(0, i % 8, i * kStride, kStride / 2);
+    map.AddRange(i % 8, i * kStride, kStride / 2);
+  }
+  uint64_t base = 0;
+  for (auto _ : state) {
+    base = base ? 0 : size;
+    if (is_rebase) {
+      segmented.Rebase(0, base);
+    } else {
+      map.RemoveRange(base ? 0 : size, size);
+      for (uint64_t i = 0; i < count; ++i) {
+        map.AddRange(i % 8, base + i * kStride, kStride / 2);
+      }
+    }
+  }
+  benchmark::DoNotOptimize(segmented);
+  benchmark::DoNotOptimize(map);
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_AddRangeSequential, RangeMap)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_AddRangeSequential, FlatRangeMap)
+    ->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_AddRangeSequential, CompactRangeMap)
+    ->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_AddRangesBulk)->Range(1 << 10, 1 << 20);
+BENCHMARK(BM_ParallelBuild)
+    ->ArgsProduct({{1 << 16, 1 << 20}, {1, 2, 4, 8}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_LoadProcMaps)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SnapshotAddRange, true)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_SnapshotAddRange, false)
+    ->Range(1 << 10, 1 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_TryGetEntryRandom, RangeMap)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_TryGetEntryRandom, FlatRangeMap)
+    ->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_TryGetEntryRandom, CompactRangeMap)
+    ->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_FrozenTryGetEntryRandom)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_MappedTryGetEntryRandom)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_TryGetEntryLocal)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_CursorTryGetEntryLocal)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_TryGetEntriesRandom)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_TryGetEntriesSorted)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_FrozenTryGetEntriesRandom)->Range(1 << 10, 1 << 22);
+BENCHMARK(BM_FrozenTryGetEntriesSorted)->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_MoveSegment, true)->Range(1 << 10, 1 << 20);
+BENCHMARK_TEMPLATE(BM_MoveSegment, false)
+    ->Range(1 << 10, 1 << 20)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_IsRangeCoveredRandom, RangeMap)
+    ->Range(1 << 10, 1 << 22);
+BENCHMARK_TEMPLATE(BM_IsRangeCoveredRandom, FlatRangeMap)
+    ->Range(1 << 10, 1 << 22);
+
+}  // namespace rangemap
+
+BENCHMARK_MAIN();
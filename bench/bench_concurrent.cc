@@ -0,0 +1,62 @@
+#include "concurrent_rangemap.h"
+#include "benchmark/benchmark.h"
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+
+namespace rangemap {
+
+namespace {
+
+const uint64_t kCount = 1 << 16;
+const uint64_t kStride = 16;
+
+ConcurrentRangeMap *GetConcurrentMap() {
+  static ConcurrentRangeMap *map = [] {
+    auto *crm = new ConcurrentRangeMap();
+    for (uint64_t i = 0; i < kCount; ++i) {
+      crm->AddRange(i % 8, i * kStride, kStride / 2);
+    }
+    crm->Publish();
+    return crm;
+  }();
+  return map;
+}
+
+void BM_ConcurrentTryGetEntry(benchmark::State &state) {
+  auto reader = GetConcurrentMap()->GetReader();
+  std::mt19937_64 rng(state.thread_index());
+  for (auto _ : state) {
+    uint64_t type, size;
+    benchmark::DoNotOptimize(
+        reader.TryGetEntry(rng() % (kCount * kStride), &type, &size));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Baseline: RangeMap behind a reader-writer lock
+void BM_SharedMutexTryGetEntry(benchmark::State &state) {
+  static std::shared_mutex mutex;
+  static RangeMap *map = [] {
+    auto *rm = new RangeMap();
+    for (uint64_t i = 0; i < kCount; ++i) {
+      rm->AddRange(i % 8, i * kStride, kStride / 2);
+    }
+    return rm;
+  }();
+  std::mt19937_64 rng(state.thread_index());
+  for (auto _ : state) {
+    uint64_t type, size;
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    benchmark::DoNotOptimize(
+        map->TryGetEntry(rng() % (kCount * kStride), &type, &size));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_ConcurrentTryGetEntry)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_SharedMutexTryGetEntry)->ThreadRange(1, 16)->UseRealTime();
+
+}  // namespace rangemap
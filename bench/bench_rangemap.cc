@@ -0,0 +1,306 @@
+#include "rangemap.h"
+#include "bench_utils.h"
+#include "benchmark/benchmark.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace rangemap {
+
+namespace {
+
+enum MapKind { kSeparate, kContinious };
+
+// Big maps are built once per size, the last one is kept
+const RangeMap &GetMap(MapKind kind, uint64_t count) {
+  static std::unique_ptr<RangeMap> map;
+  static MapKind map_kind;
+  static uint64_t map_count = 0;
+  if (!map || map_kind != kind || map_count != count) {
+    map.reset();
+    map.reset(new RangeMap());
+    if (kind == kSeparate) {
+      Fill(map.get(), count);
+    } else {
+      FillContinious(map.get(), count);
+    }
+    map_kind = kind;
+    map_count = count;
+  }
+  return *map;
+}
+
+const size_t kLookups = 1 << 16;
+
+void BM_AddRangeSeq(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  for (auto _ : state) {
+    RangeMap map;
+    Fill(&map, count);
+    benchmark::DoNotOptimize(map);
+  }
+  SetOpsCounters(state, count);
+}
+
+void BM_AddRangeRandom(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  auto addrs = RandomAddrs(count, count);
+  for (auto _ : state) {
+    RangeMap map;
+    for (uint64_t i = 0; i < count; ++i) {
+      map.AddRange(i % 8, addrs[i], kStride / 2);
+    }
+    benchmark::DoNotOptimize(map);
+  }
+  SetOpsCounters(state, count);
+}
+
+// Every range covers the second half of the previous one
+void BM_AddRangeOverlap(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  for (auto _ : state) {
+    RangeMap map;
+    for (uint64_t i = 0; i < count; ++i) {
+      map.AddRange(i % 8, i * kStride / 2, kStride);
+    }
+    benchmark::DoNotOptimize(map);
+  }
+  SetOpsCounters(state, count);
+}
+
+// Unknown size ranges fill gaps between separate entries
+void BM_AddRangeUnknown(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  for (auto _ : state) {
+    state.PauseTiming();
+    RangeMap map;
+    Fill(&map, count);
+    state.ResumeTiming();
+    for (uint64_t i = 0; i < count; ++i) {
+      map.AddRange(8, i * kStride + kStride / 2, RangeMap::kUnknownSize);
+    }
+    benchmark::DoNotOptimize(map);
+  }
+  SetOpsCounters(state, count);
+}
+
+void BM_AddRangeRel(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  for (auto _ : state) {
+    RangeMap map;
+    for (uint64_t i = 0; i < count; ++i) {
+      map.AddRangeRel(i % 8, i * kStride, kStride / 2, 1 << 20);
+    }
+    benchmark::DoNotOptimize(map);
+  }
+  SetOpsCounters(state, count);
+}
+
+// Addresses inside entries (hit) or in gaps between them (miss)
+template <bool kIsHit, bool kIsSorted>
+void BM_TryGetEntry(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const RangeMap &map = GetMap(kSeparate, count);
+  auto addrs = RandomAddrs(count, kLookups);
+  for (auto &addr : addrs) {
+    addr = addr / kStride * kStride + addr % (kStride / 2);
+    if (!kIsHit) {
+      addr += kStride / 2;
+    }
+  }
+  if (kIsSorted) {
+    std::sort(addrs.begin(), addrs.end());
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    RangeMap::range_type type;
+    RangeMap::size_type size;
+    benchmark::DoNotOptimize(map.TryGetEntry(addrs[i], &type, &size));
+    i = (i + 1) & (kLookups - 1);
+  }
+  SetOpsCounters(state, 1);
+}
+
+// Spans of range(1) entries on a continuous map
+void BM_IsRangeCovered(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const uint64_t span = state.range(1) * kStride;
+  const RangeMap &map = GetMap(kContinious, count);
+  auto addrs = RandomAddrs(count, kLookups);
+  for (auto &addr : addrs) {
+    addr = std::min(addr, count * kStride - span);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.IsRangeCovered(addrs[i], span));
+    i = (i + 1) & (kLookups - 1);
+  }
+  SetOpsCounters(state, 1);
+}
+
+// Visit range(1) entries of a continuous map with ForEachInRange or with
+// TryGetEntry for every entry
+template <bool is_visitor>
+void BM_ForEachInRange(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const uint64_t span = state.range(1) * kStride;
+  const RangeMap &map = GetMap(kContinious, count);
+  auto addrs = RandomAddrs(count, kLookups);
+  for (auto &addr : addrs) {
+    addr = std::min(addr, count * kStride - span);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    if (is_visitor) {
+      map.ForEachInRange(addrs[i], span,
+                         [&](uint64_t begin, uint64_t, size_t type) {
+                           sum += begin + type;
+                           return true;
+                         });
+    } else {
+      const uint64_t end = addrs[i] + span;
+      for (uint64_t addr = addrs[i]; addr < end;) {
+        RangeMap::range_type type;
+        RangeMap::size_type size;
+        if (!map.TryGetEntry(addr, &type, &size)) {
+          break;
+        }
+        sum += addr + type;
+        addr = addr - addr % kStride + size;
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+    i = (i + 1) & (kLookups - 1);
+  }
+  SetOpsCounters(state, 1);
+}
+
+// Overwrite spans of range(1) entries of a continuous map with two types in
+// turn. Overwritten spans become single entries, so later calls in the same
+// area replace fewer entries.
+void BM_AssignRange(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const uint64_t span = state.range(1) * kStride;
+  RangeMap map;
+  FillContinious(&map, count);
+  auto addrs = RandomAddrs(count, kLookups);
+  for (auto &addr : addrs) {
+    addr = std::min(addr, count * kStride - span);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    map.AssignRange(7, addrs[i], span);
+    map.AssignRange(8, addrs[i], span);
+    i = (i + 1) & (kLookups - 1);
+  }
+  SetOpsCounters(state, 2);
+}
+
+void BM_IsContinious(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const RangeMap &map = GetMap(kContinious, count);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(map.IsContinious());
+  }
+  SetOpsCounters(state, 1);
+  state.counters["entries_per_sec"] = benchmark::Counter(
+      double(count), benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// All gaps between entries are kStride / 2, so the only fitting gap is the
+// one after the last entry
+template <bool is_indexed>
+void BM_FindGapAtLeast(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const RangeMap &map = GetMap(kSeparate, count);
+  const uint64_t min_size = kStride;
+  for (auto _ : state) {
+    uint64_t addr = 0, size = 0;
+    if (is_indexed) {
+      map.FindGapAtLeast(min_size, &addr, &size);
+    } else {
+      map.ForEachGap(0, RangeMap::kUnknownSize,
+                     [&](uint64_t gap, uint64_t gap_size) {
+                       addr = gap;
+                       size = gap_size;
+                       return gap_size < min_size;
+                     });
+    }
+    benchmark::DoNotOptimize(addr);
+    benchmark::DoNotOptimize(size);
+  }
+  SetOpsCounters(state, 1);
+}
+
+// Subtract a map with the middle halves of every other entry from the
+// separate map, with one sweep or with a gap search in b for every entry
+template <bool is_sweep>
+void BM_Subtract(benchmark::State &state) {
+  const uint64_t count = state.range(0);
+  const RangeMap &a = GetMap(kSeparate, count);
+  RangeMap b;
+  for (uint64_t i = 0; i < count; i += 2) {
+    b.AddRange(i % 8, i * kStride + kStride / 8, kStride / 4);
+  }
+  for (auto _ : state) {
+    if (is_sweep) {
+      RangeMap result = RangeMap::Subtract(a, b);
+      benchmark::DoNotOptimize(result);
+    } else {
+      RangeMap result;
+      for (auto entry : a) {
+        b.ForEachGap(entry.begin, entry.end - entry.begin,
+                     [&](uint64_t gap, uint64_t gap_size) {
+                       result.AddRange(entry.type, gap, gap_size);
+                       return true;
+                     });
+      }
+      benchmark::DoNotOptimize(result);
+    }
+  }
+  SetOpsCounters(state, count);
+}
+
+void SizeSweep(benchmark::internal::Benchmark *bench) {
+  for (int64_t count = 1000; count <= kMaxEntries; count *= 10) {
+    bench->Arg(count);
+  }
+}
+
+void SpanSweep(benchmark::internal::Benchmark *bench) {
+  for (int64_t count = 1000; count <= kMaxEntries; count *= 10) {
+    for (int64_t span : {1, 16, 256}) {
+      bench->Args({count, span});
+    }
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_AddRangeSeq)->Apply(SizeSweep)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AddRangeRandom)->Apply(SizeSweep)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AddRangeOverlap)->Apply(SizeSweep)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AddRangeUnknown)->Apply(SizeSweep)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AddRangeRel)->Apply(SizeSweep)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_TryGetEntry, true, false)->Apply(SizeSweep);
+BENCHMARK_TEMPLATE(BM_TryGetEntry, true, true)->Apply(SizeSweep);
+BENCHMARK_TEMPLATE(BM_TryGetEntry, false, false)->Apply(SizeSweep);
+BENCHMARK_TEMPLATE(BM_TryGetEntry, false, true)->Apply(SizeSweep);
+BENCHMARK(BM_IsRangeCovered)->Apply(SpanSweep);
+BENCHMARK_TEMPLATE(BM_ForEachInRange, true)->Apply(SpanSweep);
+BENCHMARK_TEMPLATE(BM_ForEachInRange, false)->Apply(SpanSweep);
+BENCHMARK(BM_AssignRange)->Apply(SpanSweep);
+BENCHMARK(BM_IsContinious)->Apply(SizeSweep)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_FindGapAtLeast, true)->Apply(SizeSweep);
+BENCHMARK_TEMPLATE(BM_Subtract, true)
+    ->Apply(SizeSweep)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Subtract, false)
+    ->Apply(SizeSweep)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_FindGapAtLeast, false)
+    ->Apply(SizeSweep)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace rangemap
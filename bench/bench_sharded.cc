@@ -0,0 +1,49 @@
+#include "sharded_rangemap.h"
+#include "benchmark/benchmark.h"
+#include <mutex>
+
+namespace rangemap {
+
+namespace {
+
+const uint64_t kCount = 1 << 16;
+const uint64_t kStride = 16;
+const unsigned kShardBits = 4;
+
+// Every thread writes into its own 1/16 of the address space. After the first
+// kCount ranges the same ones are added again.
+uint64_t ThreadAddr(const benchmark::State &state, uint64_t i) {
+  uint64_t region = uint64_t(state.thread_index()) << (64 - kShardBits);
+  return region + (i % kCount) * kStride;
+}
+
+void BM_ShardedAddRangeDisjoint(benchmark::State &state) {
+  static ShardedRangeMap *map =
+      new ShardedRangeMap(ShardedRangeMap::SplitByHighBits(kShardBits));
+  uint64_t i = 0;
+  for (auto _ : state) {
+    map->AddRange(i % 8, ThreadAddr(state, i), kStride / 2);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Baseline: one RangeMap behind a mutex
+void BM_MutexAddRangeDisjoint(benchmark::State &state) {
+  static std::mutex mutex;
+  static RangeMap *map = new RangeMap();
+  uint64_t i = 0;
+  for (auto _ : state) {
+    std::lock_guard<std::mutex> lock(mutex);
+    map->AddRange(i % 8, ThreadAddr(state, i), kStride / 2);
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_ShardedAddRangeDisjoint)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_MutexAddRangeDisjoint)->ThreadRange(1, 16)->UseRealTime();
+
+}  // namespace rangemap
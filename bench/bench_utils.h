@@ -0,0 +1,76 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_BENCH_UTILS_INCLUDE_H
+#define RANGEMAP_BENCH_UTILS_INCLUDE_H
+
+#include <sys/resource.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "benchmark/benchmark.h"
+
+namespace rangemap {
+
+const uint64_t kStride = 16;
+
+// Biggest mapping for size sweeps, set by RANGEMAP_BENCH_MAX_ENTRIES
+#ifndef RANGEMAP_BENCH_MAX_ENTRIES
+#define RANGEMAP_BENCH_MAX_ENTRIES 100000000
+#endif
+const int64_t kMaxEntries = RANGEMAP_BENCH_MAX_ENTRIES;
+
+// Separate ranges [i * kStride, i * kStride + kStride / 2) of rotating types
+template <class Map>
+void Fill(Map *map, uint64_t count) {
+  for (uint64_t i = 0; i < count; ++i) {
+    map->AddRange(i % 8, i * kStride, kStride / 2);
+  }
+}
+
+// Continuous ranges [i * kStride, (i + 1) * kStride), types alternate so
+// entries are not merged
+template <class Map>
+void FillContinious(Map *map, uint64_t count) {
+  for (uint64_t i = 0; i < count; ++i) {
+    map->AddRange(i % 2, i * kStride, kStride);
+  }
+}
+
+inline std::vector<uint64_t> RandomAddrs(uint64_t count, size_t n) {
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> addrs(n);
+  for (auto &addr : addrs) {
+    addr = rng() % (count * kStride);
+  }
+  return addrs;
+}
+
+// Local stream: addresses go forward by a few bytes with random steps
+inline std::vector<uint64_t> LocalAddrs(uint64_t count, size_t n) {
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> addrs(n);
+  uint64_t addr = 0;
+  for (auto &a : addrs) {
+    addr = (addr + rng() % kStride) % (count * kStride);
+    a = addr;
+  }
+  return addrs;
+}
+
+// Report entries/sec and time per operation for ops operations per iteration,
+// and peak RSS of the process so far
+inline void SetOpsCounters(benchmark::State &state, uint64_t ops) {
+  state.SetItemsProcessed(state.iterations() * ops);
+  // Printed with SI prefix, e.g. 95n
+  state.counters["sec_per_op"] = benchmark::Counter(
+      double(ops), benchmark::Counter::kIsIterationInvariantRate |
+                       benchmark::Counter::kInvert);
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    // Linux reports KB
+    state.counters["peak_rss_mb"] = double(usage.ru_maxrss) / 1024;
+  }
+}
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_BENCH_UTILS_INCLUDE_H
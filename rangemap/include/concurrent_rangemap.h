@@ -0,0 +1,124 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_CONCURRENT_RANGEMAP_INCLUDE_H
+#define RANGEMAP_CONCURRENT_RANGEMAP_INCLUDE_H
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// RangeMap with lock-free readers and a single writer.
+//
+// Readers work with an immutable published version. Before reading, a reader
+// announces the version in its own slot (hazard pointer), the writer frees
+// an old version only when no slot holds it. So readers touch only the shared
+// pointer and their own cache line, no locks.
+//
+// The writer buffers ranges and Publish() applies them to a copy of the
+// current version, so updates should be batched.
+class ConcurrentRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_t kMaxReaders = 128;
+
+  ConcurrentRangeMap();
+  // All readers must be released
+  ~ConcurrentRangeMap();
+
+  ConcurrentRangeMap(const ConcurrentRangeMap &) = delete;
+  ConcurrentRangeMap &operator=(const ConcurrentRangeMap &) = delete;
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<const RangeMap *> hazard{nullptr};
+    std::atomic<bool> is_used{false};
+  };
+
+ public:
+  // Reader handle, owns a slot. Should be used by one thread at a time.
+  class Reader {
+   public:
+    Reader(Reader &&other) : owner_(other.owner_), slot_(other.slot_) {
+      other.slot_ = nullptr;
+    }
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader();
+
+    // False if there was no free slot, such reader can't read
+    bool IsValid() const { return slot_ != nullptr; }
+
+    // Run fn(const RangeMap &) against one published version. Aborts on an
+    // invalid reader.
+    template <class F>
+    auto Read(F &&fn) const -> decltype(fn(std::declval<const RangeMap &>())) {
+      Guard guard(this);
+      return fn(*guard.map);
+    }
+
+    bool TryGetEntry(size_type addr, range_type *type, size_type *size) const {
+      return Read([&](const RangeMap &map) {
+        return map.TryGetEntry(addr, type, size);
+      });
+    }
+
+    bool IsRangeCovered(size_type addr, size_type size) const {
+      return Read([&](const RangeMap &map) {
+        return map.IsRangeCovered(addr, size);
+      });
+    }
+
+    bool IsContinious() const {
+      return Read([](const RangeMap &map) { return map.IsContinious(); });
+    }
+
+   private:
+    Reader(const ConcurrentRangeMap *owner, Slot *slot)
+        : owner_(owner), slot_(slot) {}
+
+    // Protect current version while in scope
+    struct Guard {
+      explicit Guard(const Reader *reader_);
+      ~Guard();
+      const Reader *reader;
+      const RangeMap *map;
+    };
+
+    const ConcurrentRangeMap *owner_;
+    Slot *slot_;
+
+    friend class ConcurrentRangeMap;
+  };
+
+  // Take a free reader slot, at most kMaxReaders readers at once. Returns
+  // an invalid reader if all slots are used.
+  Reader GetReader();
+
+  // Writer side, not thread safe: ranges are visible after Publish()
+  void AddRange(range_type type, size_type addr, size_type size);
+  void AddRangeRel(range_type type, size_type addr, size_type size,
+                   size_type rel_addr);
+
+  // Apply buffered ranges to a copy of the current version and switch
+  // readers to it, free versions that are not read anymore
+  void Publish();
+
+  size_t PendingCount() const { return pending_.size(); }
+
+ private:
+  void Reclaim();
+
+  std::atomic<const RangeMap *> current_;
+  Slot slots_[kMaxReaders];
+
+  // Writer state
+  std::vector<RangeMap::RangeSpec> pending_;
+  std::vector<const RangeMap *> retired_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_CONCURRENT_RANGEMAP_INCLUDE_H
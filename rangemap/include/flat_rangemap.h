@@ -0,0 +1,118 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_FLAT_RANGEMAP_INCLUDE_H
+#define RANGEMAP_FLAT_RANGEMAP_INCLUDE_H
+
+#include <vector>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// Same semantics as RangeMap, but entries are kept in contiguous sorted
+// arrays (begins and payload are split), so lookup is a binary search over
+// plain keys instead of the tree walk. Insertion in the middle is O(N), so it
+// fits build-once / lookup-mostly workloads.
+class FlatRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+  static const size_type kNoRelative = RangeMap::kNoRelative;
+
+  struct Entry {
+    Entry(range_type type_, size_type size_) : type(type_), size(size_) {}
+    range_type type;
+    size_type size;
+  };
+
+  // Insert new entry [addr, addr + size]
+  void AddRange(range_type type, size_type addr, size_type size);
+
+  // Insert new entry [addr, addr + size] relative to rel_addr
+  void AddRangeRel(range_type type, size_type addr, size_type size,
+                   size_type rel_addr);
+
+  // If addr belongs to some entry, fill type and size for this entry
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+
+  // Return true if there are no gaps for [addr, addr + size]
+  bool IsRangeCovered(size_type addr, size_type size) const;
+
+  // True if there are no gaps in mapping
+  bool IsContinious() const;
+
+  // Preallocate storage for count entries
+  void Reserve(size_t count);
+
+  size_t Size() const { return begins_.size(); }
+
+ private:
+  // Positions are indexes in begins_ / entries_, Size() is the end
+  size_t AddEntry(size_t pos, range_type type, size_type addr, size_type size);
+
+  void AddRangeUnknownSize(range_type type, size_type addr);
+  void AddRangeFixedSize(range_type type, size_type addr, size_type size);
+
+  // Get entry that contains addr or the next one
+  size_t GetContainingOrNext(size_type addr) const;
+
+  // Get entry that contains addr or Size() otherwise
+  size_t GetContaining(size_type addr) const;
+
+  size_type GetEnd(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    if (IsUnknownEntry(pos)) {
+      return kUnknownSize;
+    }
+    size_type end = begins_[pos] + entries_[pos].size;
+    CHECK(end >= begins_[pos]);
+    return end;
+  }
+
+  size_type GetBegin(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    return begins_[pos];
+  }
+
+  size_type GetSize(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    return entries_[pos].size;
+  }
+
+  range_type GetType(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    return entries_[pos].type;
+  }
+
+  // Unknown size absorbs any other size
+  void AddSize(size_t pos, size_type added) {
+    CHECK(!IsEnd(pos));
+    if (IsUnknownEntry(pos) || IsUnknownSize(added)) {
+      entries_[pos].size = kUnknownSize;
+    } else {
+      entries_[pos].size += added;
+    }
+  }
+
+  bool IsEntryContains(size_t pos, size_type addr) const {
+    return ((addr >= GetBegin(pos)) && (GetEnd(pos) > addr));
+  }
+
+  void MaybeUpdateUnknownSize(size_t pos, size_type next_addr);
+
+  bool IsEnd(size_t pos) const { return pos == begins_.size(); }
+
+  bool IsUnknownEntry(size_t pos) const {
+    return GetSize(pos) == kUnknownSize;
+  }
+
+  bool IsUnknownSize(size_type size) const { return size == kUnknownSize; }
+
+  void VerifyEntry(size_t pos) const;
+
+  std::vector<size_type> begins_;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_FLAT_RANGEMAP_INCLUDE_H
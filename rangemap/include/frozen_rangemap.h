@@ -0,0 +1,107 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_FROZEN_RANGEMAP_INCLUDE_H
+#define RANGEMAP_FROZEN_RANGEMAP_INCLUDE_H
+
+#include <vector>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// Read-only snapshot of RangeMap, created by RangeMap::Freeze().
+//
+// Entry begins are stored in a static B+ tree: every level is an array of
+// cache line aligned nodes with kFanout sorted keys, a key in the inner level
+// is the max key of the corresponding child node. Leaves are the sorted begins
+// themselves, so the result of the descent is the entry index in the payload
+// arrays. Lookup costs one node per level instead of pointer chasing in
+// std::map.
+class FrozenRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+  static const size_t kFanout = 16;
+
+  FrozenRangeMap() : is_continious_(true) {}
+
+  // Same as RangeMap::TryGetEntry
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+
+  // Same as RangeMap::TryGetEntries. Unsorted batches descend the index for
+  // a group of addresses at once, so cache misses of the group overlap.
+  size_t TryGetEntries(Span<const size_type> addrs, Span<range_type> types,
+                       Span<size_type> sizes, Span<uint64_t> found) const;
+
+  // Same as RangeMap::IsRangeCovered
+  bool IsRangeCovered(size_type addr, size_type size) const;
+
+  // Same as RangeMap::IsContinious, precomputed on freeze
+  bool IsContinious() const { return is_continious_; }
+
+  size_t Size() const { return types_.size(); }
+
+  // Bytes allocated for index and payload
+  size_t MemoryUsage() const;
+
+ private:
+  struct alignas(64) Node {
+    size_type keys[kFanout];
+  };
+
+  // Entries have to be sorted and non-overlapping
+  FrozenRangeMap(std::vector<size_type> begins, std::vector<range_type> types,
+                 std::vector<size_type> sizes);
+
+  void BuildIndex(const std::vector<size_type> &begins);
+
+  // Number of keys in node that are <= addr, SIMD if available
+  static size_t CountLessOrEqual(const Node &node, size_type addr);
+
+  // Index of the first entry that begins after addr, or Size()
+  size_t UpperBound(size_type addr) const;
+
+  // UpperBound for count (<= kGroupSize) addresses at once
+  void UpperBoundGroup(const size_type *addrs, size_t count,
+                       size_t *result) const;
+  static const size_t kGroupSize = 16;
+  static const size_t kMaxSweepSteps = 8;
+
+  // Get entry that contains addr or the next one
+  size_t GetContainingOrNext(size_type addr) const;
+
+  bool IsEnd(size_t pos) const { return pos == Size(); }
+
+  // Leaf level keeps the begins
+  size_type GetBegin(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    return levels_.back()[pos / kFanout].keys[pos % kFanout];
+  }
+
+  size_type GetEnd(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    if (sizes_[pos] == kUnknownSize) {
+      return kUnknownSize;
+    }
+    return GetBegin(pos) + sizes_[pos];
+  }
+
+  bool IsEntryContains(size_t pos, size_type addr) const {
+    return ((addr >= GetBegin(pos)) && (GetEnd(pos) > addr));
+  }
+
+  // Levels of the tree from the root to the leaves
+  std::vector<std::vector<Node>> levels_;
+
+  // Payload in entry order
+  std::vector<range_type> types_;
+  std::vector<size_type> sizes_;
+
+  bool is_continious_;
+
+  template <class, class, class>
+  friend class BasicRangeMap;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_FROZEN_RANGEMAP_INCLUDE_H
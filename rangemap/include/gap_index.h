@@ -0,0 +1,434 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_GAP_INDEX_INCLUDE_H
+#define RANGEMAP_GAP_INDEX_INCLUDE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+#include "node_pool.h"
+#include "utils.h"
+
+namespace rangemap {
+
+// Uncovered parts of the address space [0, kEnd) as a treap keyed by gap
+// begin. Every node keeps the max gap size of its subtree, so the first gap
+// of at least K bytes is found with one descent. The gap after the last
+// covered byte is kept out of the tree: appends only touch it and the right
+// spine. Nodes live in a vector over the upstream resource of the owner map,
+// the index is copied with it.
+template <class AddrT>
+class GapIndex {
+ public:
+  typedef AddrT addr_type;
+  // End of the address space, gaps after the last entry end here
+  static const AddrT kEnd = std::numeric_limits<AddrT>::max();
+
+  explicit GapIndex(
+      std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+      : nodes_(ResourceAllocator<Node>(upstream)),
+        free_(ResourceAllocator<Index>(upstream)) {
+    Clear();
+  }
+
+  // Whole address space is one gap
+  void Clear() {
+    nodes_.clear();
+    free_.clear();
+    count_ = 0;
+    seed_ = 0x2545f4914f6cdd1dULL;
+    root_ = kNil;
+    tail_begin_ = 0;
+  }
+
+  // Make sure count gaps fit without reallocation
+  void Reserve(size_t count) {
+    nodes_.reserve(count);
+    free_.reserve(count);
+  }
+
+  // [begin, end) becomes covered, may take parts of several gaps
+  void Cover(AddrT begin, AddrT end) {
+    CHECK(begin < end);
+    if (end > tail_begin_) {
+      AddrT tail_begin = tail_begin_;
+      tail_begin_ = end;
+      if (begin > tail_begin) {
+        // Space before the range stays a gap, it is the last one in the tree
+        Index node = NewNode(tail_begin, begin);
+        root_ = Append(root_, node);
+        return;
+      }
+      if (begin == tail_begin) {
+        return;
+      }
+      end = tail_begin;
+    }
+    CoverTree(begin, end);
+  }
+
+  // [begin, end) becomes a gap, joins gaps inside and next to it
+  void Uncover(AddrT begin, AddrT end) {
+    CHECK(begin < end);
+    Index left, right;
+    Split(root_, begin, &left, &right);
+    // Gap before begin that reaches it
+    Index prev = Max(left);
+    if (prev != kNil && nodes_[prev].end >= begin) {
+      end = std::max(end, nodes_[prev].end);
+      begin = nodes_[prev].begin;
+      Index single;
+      Split(left, begin, &left, &single);
+      FreeNode(single);
+    }
+    if (end >= tail_begin_) {
+      // Everything from begin goes into the tail
+      FreeTree(right);
+      tail_begin_ = std::min(tail_begin_, begin);
+      root_ = left;
+      return;
+    }
+    // Gaps that start in [begin, end] are joined, end < kEnd here
+    Index middle;
+    Split(right, end + 1, &middle, &right);
+    Index last = Max(middle);
+    if (last != kNil) {
+      end = std::max(end, nodes_[last].end);
+    }
+    FreeTree(middle);
+    Index node = NewNode(begin, end);
+    root_ = Merge(Merge(left, node), right);
+  }
+
+  // Gap that contains addr, or the next one
+  bool FindContainingOrNext(AddrT addr, AddrT *begin, AddrT *end) const {
+    Index found = kNil;
+    Index node = root_;
+    while (node != kNil) {
+      if (nodes_[node].end > addr) {
+        found = node;
+        node = nodes_[node].left;
+      } else {
+        node = nodes_[node].right;
+      }
+    }
+    if (found != kNil) {
+      *begin = nodes_[found].begin;
+      *end = nodes_[found].end;
+      return true;
+    }
+    if (HasTail()) {
+      *begin = tail_begin_;
+      *end = kEnd;
+      return true;
+    }
+    return false;
+  }
+
+  // First gap part [max(gap begin, from), gap end) of at least min_size
+  bool FindAtLeast(AddrT min_size, AddrT from, AddrT *begin,
+                   AddrT *end) const {
+    AddrT gap_begin, gap_end;
+    if (FindContainingOrNext(from, &gap_begin, &gap_end) &&
+        gap_begin <= from && gap_end - from >= min_size) {
+      *begin = from;
+      *end = gap_end;
+      return true;
+    }
+    Index found = FindFirstAfter(root_, from, min_size);
+    if (found != kNil) {
+      *begin = nodes_[found].begin;
+      *end = nodes_[found].end;
+      return true;
+    }
+    if (HasTail() && tail_begin_ > from && kEnd - tail_begin_ >= min_size) {
+      *begin = tail_begin_;
+      *end = kEnd;
+      return true;
+    }
+    return false;
+  }
+
+  size_t Count() const { return count_ + (HasTail() ? 1 : 0); }
+
+  // Gaps in address order, fn(begin, end)
+  template <class F>
+  void ForEach(F &&fn) const {
+    ForEach(root_, fn);
+    if (HasTail()) {
+      fn(tail_begin_, kEnd);
+    }
+  }
+
+ private:
+  typedef uint32_t Index;
+  static const Index kNil = std::numeric_limits<Index>::max();
+
+  struct Node {
+    AddrT begin;
+    AddrT end;
+    // Max gap size in the subtree
+    AddrT max_size;
+    Index left;
+    Index right;
+    uint32_t priority;
+  };
+
+  Index NewNode(AddrT begin, AddrT end) {
+    CHECK(begin < end);
+    Index node;
+    if (!free_.empty()) {
+      node = free_.back();
+      free_.pop_back();
+    } else {
+      CHECK(nodes_.size() < kNil);
+      node = nodes_.size();
+      nodes_.emplace_back();
+    }
+    // xorshift is enough for treap priorities
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    nodes_[node] = {begin, end, end - begin, kNil, kNil, uint32_t(seed_)};
+    ++count_;
+    return node;
+  }
+
+  void FreeNode(Index node) {
+    CHECK(node != kNil);
+    free_.push_back(node);
+    --count_;
+  }
+
+  void FreeTree(Index node) {
+    if (node == kNil) {
+      return;
+    }
+    FreeTree(nodes_[node].left);
+    FreeTree(nodes_[node].right);
+    FreeNode(node);
+  }
+
+  AddrT MaxSize(Index node) const {
+    return (node == kNil) ? 0 : nodes_[node].max_size;
+  }
+
+  void Update(Index node) {
+    Node &n = nodes_[node];
+    n.max_size = std::max(n.end - n.begin,
+                          std::max(MaxSize(n.left), MaxSize(n.right)));
+  }
+
+  bool HasTail() const { return tail_begin_ != kEnd; }
+
+  // Cover for gaps before the tail
+  void CoverTree(AddrT begin, AddrT end) {
+    AddrT rest_end;
+    bool is_max_changed;
+    if (TryTrim(root_, begin, end, &rest_end, &is_max_changed)) {
+      if (rest_end > end) {
+        Index node = NewNode(end, rest_end);
+        root_ = Insert(root_, node);
+      }
+      return;
+    }
+    Index left, right;
+    Split(root_, begin, &left, &right);
+    // Gap that starts before begin may go into the range
+    Index last = Max(left);
+    if (last != kNil && nodes_[last].end > begin) {
+      AddrT last_begin = nodes_[last].begin;
+      AddrT last_end = nodes_[last].end;
+      Index single;
+      Split(left, last_begin, &left, &single);
+      FreeNode(single);
+      Index node = NewNode(last_begin, begin);
+      left = Merge(left, node);
+      if (last_end > end) {
+        node = NewNode(end, last_end);
+        right = Merge(node, right);
+      }
+    }
+    // Gaps that start inside the range are dropped, the tail of the last
+    // one is kept
+    Index middle;
+    Split(right, end, &middle, &right);
+    last = Max(middle);
+    if (last != kNil && nodes_[last].end > end) {
+      Index node = NewNode(end, nodes_[last].end);
+      right = Merge(node, right);
+    }
+    FreeTree(middle);
+    root_ = Merge(left, right);
+  }
+
+  // Fast path of Cover: if [begin, end) is inside one gap and does not take
+  // all of it, cut it out in place. The node keeps the first part, the
+  // second one is [end, *rest_end) if *rest_end > end. Ancestors are updated
+  // only while the max size changes.
+  bool TryTrim(Index node, AddrT begin, AddrT end, AddrT *rest_end,
+               bool *is_max_changed) {
+    if (node == kNil) {
+      return false;
+    }
+    Node &n = nodes_[node];
+    if (begin < n.begin || begin >= n.end) {
+      Index child = (begin < n.begin) ? n.left : n.right;
+      if (!TryTrim(child, begin, end, rest_end, is_max_changed)) {
+        return false;
+      }
+      if (!*is_max_changed) {
+        return true;
+      }
+    } else {
+      if (end > n.end || (begin == n.begin && end == n.end)) {
+        return false;
+      }
+      *rest_end = end;
+      if (begin == n.begin) {
+        // Order of gaps is kept, begin may change in place
+        n.begin = end;
+      } else {
+        *rest_end = n.end;
+        n.end = begin;
+      }
+    }
+    AddrT old_max_size = n.max_size;
+    Update(node);
+    *is_max_changed = (n.max_size != old_max_size);
+    return true;
+  }
+
+  // Insert item that does not overlap other gaps
+  Index Insert(Index node, Index item) {
+    if (node == kNil) {
+      return item;
+    }
+    if (nodes_[item].priority > nodes_[node].priority) {
+      Split(node, nodes_[item].begin, &nodes_[item].left, &nodes_[item].right);
+      Update(item);
+      return item;
+    }
+    // Max size may only grow
+    Node &n = nodes_[node];
+    n.max_size = std::max(n.max_size, nodes_[item].max_size);
+    if (nodes_[item].begin < n.begin) {
+      n.left = Insert(n.left, item);
+    } else {
+      n.right = Insert(n.right, item);
+    }
+    return node;
+  }
+
+  // Insert item that goes after all gaps of node
+  Index Append(Index node, Index item) {
+    if (node == kNil) {
+      return item;
+    }
+    if (nodes_[item].priority > nodes_[node].priority) {
+      nodes_[item].left = node;
+      Update(item);
+      return item;
+    }
+    Node &n = nodes_[node];
+    n.max_size = std::max(n.max_size, nodes_[item].max_size);
+    n.right = Append(n.right, item);
+    return node;
+  }
+
+  // left gets gaps with begin < key, right the rest
+  void Split(Index node, AddrT key, Index *left, Index *right) {
+    if (node == kNil) {
+      *left = kNil;
+      *right = kNil;
+      return;
+    }
+    if (nodes_[node].begin < key) {
+      Split(nodes_[node].right, key, &nodes_[node].right, right);
+      *left = node;
+    } else {
+      Split(nodes_[node].left, key, left, &nodes_[node].left);
+      *right = node;
+    }
+    Update(node);
+  }
+
+  // All gaps of left go before gaps of right
+  Index Merge(Index left, Index right) {
+    if (left == kNil) {
+      return right;
+    }
+    if (right == kNil) {
+      return left;
+    }
+    if (nodes_[left].priority > nodes_[right].priority) {
+      nodes_[left].right = Merge(nodes_[left].right, right);
+      Update(left);
+      return left;
+    }
+    nodes_[right].left = Merge(left, nodes_[right].left);
+    Update(right);
+    return right;
+  }
+
+  Index Min(Index node) const {
+    while (node != kNil && nodes_[node].left != kNil) {
+      node = nodes_[node].left;
+    }
+    return node;
+  }
+
+  Index Max(Index node) const {
+    while (node != kNil && nodes_[node].right != kNil) {
+      node = nodes_[node].right;
+    }
+    return node;
+  }
+
+  // First gap with begin > from and size >= min_size
+  Index FindFirstAfter(Index node, AddrT from, AddrT min_size) const {
+    if (node == kNil || MaxSize(node) < min_size) {
+      return kNil;
+    }
+    const Node &n = nodes_[node];
+    if (n.begin <= from) {
+      return FindFirstAfter(n.right, from, min_size);
+    }
+    Index found = FindFirstAfter(n.left, from, min_size);
+    if (found != kNil) {
+      return found;
+    }
+    if (n.end - n.begin >= min_size) {
+      return node;
+    }
+    return FindFirstAfter(n.right, from, min_size);
+  }
+
+  template <class F>
+  void ForEach(Index node, F &fn) const {
+    if (node == kNil) {
+      return;
+    }
+    ForEach(nodes_[node].left, fn);
+    fn(nodes_[node].begin, nodes_[node].end);
+    ForEach(nodes_[node].right, fn);
+  }
+
+  std::vector<Node, ResourceAllocator<Node>> nodes_;
+  std::vector<Index, ResourceAllocator<Index>> free_;
+  Index root_;
+  // Gap [tail_begin_, kEnd), empty if tail_begin_ == kEnd
+  AddrT tail_begin_;
+  size_t count_;
+  uint64_t seed_;
+};
+
+template <class AddrT>
+const AddrT GapIndex<AddrT>::kEnd;
+template <class AddrT>
+const typename GapIndex<AddrT>::Index GapIndex<AddrT>::kNil;
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_GAP_INDEX_INCLUDE_H
@@ -0,0 +1,236 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_LOADER_INCLUDE_H
+#define RANGEMAP_LOADER_INCLUDE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// Read-only view of an ELF file.
+//
+// The file is mmap'ed and program and section headers are decoded in place
+// on every access, nothing is copied on open. 32 and 64-bit files of the
+// host byte order are supported.
+class ElfFile {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+
+  struct Segment {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t size;
+  };
+
+  struct Section {
+    // Points into the mapping, empty if the name is out of the string table
+    std::string_view name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t size;
+  };
+
+  // Return nullptr if the file can't be mapped or headers are out of it
+  static std::unique_ptr<ElfFile> Open(const std::string &path);
+
+  ~ElfFile();
+
+  ElfFile(const ElfFile &) = delete;
+  ElfFile &operator=(const ElfFile &) = delete;
+
+  // Shared object or PIE, addresses are relative to the load base
+  bool IsRelocatable() const { return is_relocatable_; }
+
+  size_t SegmentCount() const { return segment_count_; }
+  Segment GetSegment(size_t i) const;
+
+  size_t SectionCount() const { return section_count_; }
+  Section GetSection(size_t i) const;
+
+  // Append every non-empty PT_LOAD segment as a range of the type. base is
+  // added to addresses of relocatable files and ignored for others. Ranges
+  // that would wrap around the address space are skipped.
+  void AppendSegments(range_type type, size_type base,
+                      std::vector<RangeMap::RangeSpec> *specs) const;
+
+  // Append every non-empty allocated section, section i gets type
+  // first_type + i. base is used as in AppendSegments.
+  void AppendSections(range_type first_type, size_type base,
+                      std::vector<RangeMap::RangeSpec> *specs) const;
+
+ private:
+  ElfFile(void *data, size_t data_size);
+
+  template <class Ehdr, class Phdr, class Shdr>
+  bool Parse();
+
+  template <class Phdr>
+  Segment ReadSegment(size_t i) const;
+
+  template <class Shdr>
+  Section ReadSection(size_t i) const;
+
+  size_type GetBase(size_type base) const {
+    return is_relocatable_ ? base : 0;
+  }
+
+  void *data_;
+  size_t data_size_;
+
+  bool is_64_;
+  bool is_relocatable_;
+  // Point into the mapping
+  const char *segments_;
+  size_t segment_count_;
+  size_t segment_entry_size_;
+  const char *sections_;
+  size_t section_count_;
+  size_t section_entry_size_;
+  const char *names_;
+  size_t names_size_;
+};
+
+// Streaming parser of the /proc/<pid>/maps text format.
+//
+// Text may come in chunks of any size, only a line split between chunks is
+// copied.
+class ProcMapsParser {
+ public:
+  // Permission bits
+  static const uint32_t kRead = 1;
+  static const uint32_t kWrite = 2;
+  static const uint32_t kExec = 4;
+  static const uint32_t kShared = 8;
+
+  struct Mapping {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t offset;
+    uint64_t inode;
+    uint32_t perms;
+    // Valid during the callback only, empty for anonymous mappings
+    std::string_view path;
+  };
+
+  // Call fn(mapping) for every complete line of the chunk. Return false on
+  // a malformed line, the parser should not be used after that.
+  template <class F>
+  bool Feed(const char *data, size_t size, F &&fn) {
+    const char *end = data + size;
+    while (data != end) {
+      const char *eol =
+          static_cast<const char *>(std::memchr(data, '\n', end - data));
+      if (eol == nullptr) {
+        partial_.append(data, end);
+        return true;
+      }
+      bool is_ok;
+      if (partial_.empty()) {
+        is_ok = ParseLine(std::string_view(data, eol - data), fn);
+      } else {
+        partial_.append(data, eol);
+        is_ok = ParseLine(partial_, fn);
+        partial_.clear();
+      }
+      if (!is_ok) {
+        return false;
+      }
+      data = eol + 1;
+    }
+    return true;
+  }
+
+  // Parse the last line if the text does not end with a newline
+  template <class F>
+  bool Finish(F &&fn) {
+    bool is_ok = ParseLine(partial_, fn);
+    partial_.clear();
+    return is_ok;
+  }
+
+  // Feed the whole file in chunks. Return false if it can't be read or has
+  // a malformed line.
+  template <class F>
+  bool ParseFile(const std::string &path, F &&fn) {
+    std::FILE *file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+      return false;
+    }
+    std::vector<char> buffer(kChunkSize);
+    bool is_ok = true;
+    while (is_ok) {
+      size_t size = std::fread(buffer.data(), 1, buffer.size(), file);
+      if (size == 0) {
+        break;
+      }
+      is_ok = Feed(buffer.data(), size, fn);
+    }
+    is_ok = is_ok && !std::ferror(file) && Finish(fn);
+    std::fclose(file);
+    return is_ok;
+  }
+
+  // Parse one line without the newline, empty lines are valid
+  static bool ParseMapping(std::string_view line, bool *is_empty,
+                           Mapping *mapping);
+
+ private:
+  static const size_t kChunkSize = 64 * 1024;
+
+  template <class F>
+  static bool ParseLine(std::string_view line, F &&fn) {
+    bool is_empty;
+    Mapping mapping;
+    if (!ParseMapping(line, &is_empty, &mapping)) {
+      return false;
+    }
+    if (!is_empty) {
+      fn(mapping);
+    }
+    return true;
+  }
+
+  std::string partial_;
+};
+
+// Add every mapping of a /proc/<pid>/maps format file to the map with one
+// AddRanges call. fn(mapping, &type) sets the type of the mapping (0 if
+// not set) or returns false to skip it. Return false if the file can't be
+// parsed, the map is not changed then.
+template <class F>
+bool LoadProcMaps(const std::string &path, F &&fn, RangeMap *map) {
+  std::vector<RangeMap::RangeSpec> specs;
+  ProcMapsParser parser;
+  bool is_ok = parser.ParseFile(
+      path, [&](const ProcMapsParser::Mapping &mapping) {
+        RangeMap::range_type type = 0;
+        if (mapping.end > mapping.begin && fn(mapping, &type)) {
+          specs.push_back({type, mapping.begin, mapping.end - mapping.begin});
+        }
+      });
+  if (!is_ok) {
+    return false;
+  }
+  // Kernel lists mappings in address order
+  bool is_sorted = std::is_sorted(
+      specs.begin(), specs.end(),
+      [](const RangeMap::RangeSpec &a, const RangeMap::RangeSpec &b) {
+        return a.addr < b.addr;
+      });
+  map->AddRanges(specs, is_sorted);
+  return true;
+}
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_LOADER_INCLUDE_H
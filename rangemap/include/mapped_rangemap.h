@@ -0,0 +1,76 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_MAPPED_RANGEMAP_INCLUDE_H
+#define RANGEMAP_MAPPED_RANGEMAP_INCLUDE_H
+
+#include <memory>
+#include <string>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// Read-only RangeMap over a file written by RangeMap::SaveTo().
+//
+// The file is mmap'ed and lookups read the sorted arrays in place, so
+// opening costs the same for any map size and processes that open the same
+// file share its page cache.
+class MappedRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+
+  // Return nullptr if the file can't be mapped or has a wrong header.
+  // is_verify also checks the payload checksum, that reads the whole file.
+  static std::unique_ptr<MappedRangeMap> Open(const std::string &path,
+                                              bool is_verify = false);
+
+  ~MappedRangeMap();
+
+  MappedRangeMap(const MappedRangeMap &) = delete;
+  MappedRangeMap &operator=(const MappedRangeMap &) = delete;
+
+  // Same as RangeMap::TryGetEntry
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+
+  // Same as RangeMap::IsRangeCovered
+  bool IsRangeCovered(size_type addr, size_type size) const;
+
+  // Same as RangeMap::IsContinious, stored in the file
+  bool IsContinious() const { return is_continious_; }
+
+  size_t Size() const { return count_; }
+
+ private:
+  MappedRangeMap(void *data, size_t data_size);
+
+  // Get entry that contains addr or the next one
+  size_t GetContainingOrNext(size_type addr) const;
+
+  bool IsEnd(size_t pos) const { return pos == count_; }
+
+  size_type GetEnd(size_t pos) const {
+    CHECK(!IsEnd(pos));
+    if (sizes_[pos] == kUnknownSize) {
+      return kUnknownSize;
+    }
+    return begins_[pos] + sizes_[pos];
+  }
+
+  bool IsEntryContains(size_t pos, size_type addr) const {
+    return ((addr >= begins_[pos]) && (GetEnd(pos) > addr));
+  }
+
+  void *data_;
+  size_t data_size_;
+
+  // Point into the mapping
+  const size_type *begins_;
+  const uint64_t *types_;
+  const size_type *sizes_;
+  size_t count_;
+  bool is_continious_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_MAPPED_RANGEMAP_INCLUDE_H
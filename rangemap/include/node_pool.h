@@ -0,0 +1,149 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_NODE_POOL_INCLUDE_H
+#define RANGEMAP_NODE_POOL_INCLUDE_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+#include "utils.h"
+
+namespace rangemap {
+
+// Free list of fixed size blocks carved from big chunks of upstream memory.
+//
+// Until the first Reserve() every call goes to upstream, so a map that
+// never reserves behaves as with the default allocator. After it, blocks
+// come from the free list, chunks grow geometrically when it is empty.
+// Chunks are returned to upstream only in the destructor. Not thread safe.
+class NodePool {
+ public:
+  NodePool(size_t block_size, std::pmr::memory_resource *upstream);
+  ~NodePool();
+
+  NodePool(const NodePool &) = delete;
+  NodePool &operator=(const NodePool &) = delete;
+
+  void *Allocate(size_t bytes, size_t alignment);
+  void Deallocate(void *ptr, size_t bytes, size_t alignment);
+
+  // Make sure next count blocks are allocated without upstream calls
+  void Reserve(size_t count);
+
+  size_t FreeCount() const { return free_count_; }
+  size_t BlockSize() const { return block_size_; }
+  std::pmr::memory_resource *Upstream() const { return upstream_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct Chunk {
+    char *data;
+    size_t size;
+  };
+
+  static const size_t kAlignment = alignof(std::max_align_t);
+  static const size_t kMinChunkBlocks = 16;
+
+  bool IsPooled(size_t bytes, size_t alignment) const {
+    return is_active_ && bytes <= block_size_ && alignment <= kAlignment;
+  }
+
+  // Block was carved from one of chunks_
+  bool IsOwned(const void *ptr) const;
+
+  void Grow(size_t count);
+
+  size_t block_size_;
+  std::pmr::memory_resource *upstream_;
+  bool is_active_;
+  FreeBlock *free_list_;
+  size_t free_count_;
+  size_t block_count_;
+  std::vector<Chunk> chunks_;
+};
+
+// Allocator over a NodePool owned by the container owner. Raw pointer on
+// purpose: node handles in libstdc++ do not destroy the allocator copy after
+// reinsert, so a refcounted pool would leak.
+template <class T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  explicit PoolAllocator(NodePool *pool) : pool_(pool) {}
+  template <class U>
+  PoolAllocator(const PoolAllocator<U> &other) : pool_(other.pool_) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(pool_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    pool_->Deallocate(ptr, n * sizeof(T), alignof(T));
+  }
+
+  NodePool *GetPool() const { return pool_; }
+
+  template <class U>
+  bool operator==(const PoolAllocator<U> &other) const {
+    return pool_ == other.pool_;
+  }
+  template <class U>
+  bool operator!=(const PoolAllocator<U> &other) const {
+    return pool_ != other.pool_;
+  }
+
+ private:
+  template <class U>
+  friend class PoolAllocator;
+
+  NodePool *pool_;
+};
+
+// Allocator over the upstream resource of a map. Unlike
+// std::pmr::polymorphic_allocator it goes along on move and swap, so the
+// containers of a map are swapped without copies when the map is moved.
+template <class T>
+class ResourceAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  explicit ResourceAllocator(std::pmr::memory_resource *resource)
+      : resource_(resource) {}
+  template <class U>
+  ResourceAllocator(const ResourceAllocator<U> &other)
+      : resource_(other.resource_) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(resource_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, size_t n) {
+    resource_->deallocate(ptr, n * sizeof(T), alignof(T));
+  }
+
+  template <class U>
+  bool operator==(const ResourceAllocator<U> &other) const {
+    return resource_ == other.resource_;
+  }
+  template <class U>
+  bool operator!=(const ResourceAllocator<U> &other) const {
+    return resource_ != other.resource_;
+  }
+
+ private:
+  template <class U>
+  friend class ResourceAllocator;
+
+  std::pmr::memory_resource *resource_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_NODE_POOL_INCLUDE_H
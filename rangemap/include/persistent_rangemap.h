@@ -0,0 +1,101 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_PERSISTENT_RANGEMAP_INCLUDE_H
+#define RANGEMAP_PERSISTENT_RANGEMAP_INCLUDE_H
+
+#include <cstdint>
+#include <memory>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// RangeMap with O(1) snapshots.
+//
+// Entries live in a persistent treap: nodes are never changed after
+// creation, an update copies only the nodes on the paths it touches and
+// shares the rest with older versions. Snapshot() copies the root pointer,
+// nodes are freed by reference counting when no version uses them. A
+// snapshot is a separate object, it can be read from other threads while
+// the owner keeps updating.
+class PersistentRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+
+  PersistentRangeMap();
+  // Copies share all nodes
+  PersistentRangeMap(const PersistentRangeMap &other);
+  PersistentRangeMap &operator=(const PersistentRangeMap &other);
+
+  // Same as RangeMap::AddRange. Copies O(log n + k) nodes for k entries
+  // that the range overlaps.
+  void AddRange(range_type type, size_type addr, size_type size);
+
+  // Current version, O(1)
+  PersistentRangeMap Snapshot() const { return *this; }
+
+  // Same as RangeMap::TryGetEntry
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+
+  // Same as RangeMap::IsRangeCovered, O(k log n) for k covering entries
+  bool IsRangeCovered(size_type addr, size_type size) const;
+
+  size_t Size() const { return count_; }
+
+  // Call fn(begin, size, type) for every entry in address order
+  template <class F>
+  void ForEach(F &&fn) const {
+    ForEach(root_.get(), fn);
+  }
+
+ private:
+  struct Node;
+  typedef std::shared_ptr<const Node> NodePtr;
+
+  struct Node {
+    size_type begin;
+    size_type size;
+    range_type type;
+    uint32_t priority;
+    NodePtr left;
+    NodePtr right;
+  };
+
+  NodePtr NewNode(size_type begin, size_type size, range_type type,
+                  uint32_t priority, NodePtr left, NodePtr right) const;
+  NodePtr CopyWith(const Node &node, NodePtr left, NodePtr right) const;
+
+  // l gets keys < key, r gets the rest. Copies the nodes on the path.
+  void Split(const NodePtr &node, size_type key, NodePtr *l,
+             NodePtr *r) const;
+  // All keys of l go before keys of r
+  NodePtr Merge(const NodePtr &l, const NodePtr &r) const;
+
+  // Last entry that begins at or before addr, null if none
+  const Node *FindLastNotAfter(size_type addr) const;
+
+  size_type GetEnd(const Node &node) const {
+    return (node.size == kUnknownSize) ? kUnknownSize : node.begin + node.size;
+  }
+
+  template <class F>
+  static void ForEach(const Node *node, F &fn) {
+    if (node == nullptr) {
+      return;
+    }
+    ForEach(node->left.get(), fn);
+    fn(node->begin, node->size, node->type);
+    ForEach(node->right.get(), fn);
+  }
+
+  NodePtr root_;
+  size_t count_;
+  uint64_t seed_;
+  // Entries that the update may change are replayed here with RangeMap
+  // rules, then put back. Not shared between copies.
+  RangeMap scratch_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_PERSISTENT_RANGEMAP_INCLUDE_H
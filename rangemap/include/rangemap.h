@@ -2,31 +2,67 @@
 #ifndef RANGEMAP_INCLUDE_H
 #define RANGEMAP_INCLUDE_H
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include "gap_index.h"
+#include "node_pool.h"
+#include "stats.h"
 #include "utils.h"
 
 namespace rangemap {
 
-class RangeMap {
+class FrozenRangeMap;
+
+// Mapping of address ranges to types. Widths of addresses, sizes and types
+// are template parameters, so maps with small address spaces and few types
+// take less memory per entry (see CompactRangeMap). Sizes are differences of
+// addresses and kUnknownSize is also the end of the address space, so AddrT
+// and SizeT have to be unsigned types of the same width.
+template <class AddrT, class SizeT, class TypeT>
+class BasicRangeMap {
+  static_assert(std::is_unsigned<AddrT>::value &&
+                    std::is_unsigned<SizeT>::value &&
+                    sizeof(AddrT) == sizeof(SizeT),
+                "addresses and sizes should be unsigned of the same width");
+
  public:
-  typedef uint64_t size_type;
-  typedef size_t range_type;
-  // TODO: option for strick new ranges without overlapping
+  typedef AddrT addr_type;
+  typedef SizeT size_type;
+  typedef TypeT range_type;
   static const size_type kUnknownSize = std::numeric_limits<size_type>::max();
   static const size_type kNoRelative = std::numeric_limits<size_type>::max();
 
   struct Entry {
-    Entry(range_type type_, size_type size_)
-        : type(type_), size(size_), rel_addr(kNoRelative) {}
-    Entry(range_type type_, size_type size_, size_type rel_addr_)
-        : type(type_), size(size_), rel_addr(rel_addr_) {}
+    Entry(range_type type_, size_type size_) : type(type_), size(size_) {}
     range_type type;
     size_type size;
-    size_type rel_addr;
-    bool IsRelative() const { return rel_addr == kNoRelative; }
   };
 
+  BasicRangeMap();
+  // Entries are allocated from upstream, or from a node pool after Reserve()
+  explicit BasicRangeMap(std::pmr::memory_resource *upstream);
+
+  // Copy gets its own pool with the same upstream, moves take the pool along
+  // and allocate nothing. Moved-from map is empty, it makes a new pool on
+  // the first insert.
+  BasicRangeMap(const BasicRangeMap &other);
+  BasicRangeMap(BasicRangeMap &&other) noexcept;
+  BasicRangeMap &operator=(const BasicRangeMap &other);
+  BasicRangeMap &operator=(BasicRangeMap &&other) noexcept;
+
+  // Preallocate nodes so the map grows to count entries without heap calls.
+  // Only the first entry of a new type allocates, for its counters.
+  void Reserve(size_t count);
+
   // Insert new entry [addr, addr + size]
   void AddRange(range_type type, size_type addr, size_type size);
 
@@ -34,27 +70,384 @@ class RangeMap {
   void AddRangeRel(range_type type, size_type addr, size_type size,
                    size_type rel_addr);
 
+  struct RangeSpec {
+    range_type type;
+    size_type addr;
+    size_type size;
+  };
+
+  // Same result as AddRange for every spec in order. Runs of fixed size
+  // ranges are sorted (skipped if is_sorted) and merged into the mapping in
+  // one pass; unknown size ranges and ranges that end at or after the begin
+  // of an unknown size tail go through AddRange.
+  void AddRanges(Span<const RangeSpec> ranges, bool is_sorted = false);
+
+  // Entry as seen by iteration: [begin, end), end is kUnknownSize for the
+  // unknown size tail
+  struct EntryView {
+    size_type begin;
+    size_type end;
+    range_type type;
+  };
+
+  // Insert [addr, addr + size) only if it does not overlap any entry, an
+  // unknown size tail overlaps everything after its begin. Otherwise keep
+  // the map as is, fill conflict (if not null) with the first overlapping
+  // entry and return false. One tree search in both cases. A range that
+  // wraps around the address space is rejected without a conflict.
+  bool TryAddRangeStrict(range_type type, size_type addr, size_type size,
+                         EntryView *conflict = nullptr);
+
+  // Fill gaps of the mapping with entries of lower_priority, same as
+  // AddRange for all its entries in address order. One pass over both maps
+  // when this one has no unknown size tail, O(n + m).
+  void Merge(const BasicRangeMap &lower_priority);
+
+  // Build mapping from sources with up to threads threads: every thread
+  // adds a run of sources with AddRanges into its own map, then maps are
+  // merged pairwise in parallel. Earlier sources win on overlap, the result
+  // is the same as AddRanges for every source in order unless sources have
+  // unknown size ranges (those are resolved inside their thread's map).
+  static BasicRangeMap ParallelBuild(Span<const Span<const RangeSpec>> sources,
+                                     size_t threads);
+
+  // Parts of a entries covered by b, types are taken from a. One sweep over
+  // both maps, O(n + m).
+  static BasicRangeMap Intersect(const BasicRangeMap &a, const BasicRangeMap &b);
+
+  // Parts of a entries not covered by b. O(n + m).
+  static BasicRangeMap Subtract(const BasicRangeMap &a, const BasicRangeMap &b);
+
+  // Call fn(begin, end, old_type, new_type) for every part of the address
+  // space where old_map and new_map differ in address order, stop when fn
+  // returns false. Types point to the type of the covering entry or are
+  // null if the address is not covered. Neighbour parts with the same pair
+  // of types are joined. O(n + m).
+  template <class F>
+  static void Diff(const BasicRangeMap &old_map, const BasicRangeMap &new_map,
+                   F &&fn) {
+    bool has_part = false;
+    size_type part_begin = 0, part_end = 0;
+    const range_type *part_old = nullptr;
+    const range_type *part_new = nullptr;
+    auto is_same = [](const range_type *x, const range_type *y) {
+      return (x == nullptr || y == nullptr) ? x == y : *x == *y;
+    };
+    bool is_stopped = false;
+    Sweep(old_map, new_map,
+          [&](size_type begin, size_type end, const range_type *old_type,
+              const range_type *new_type) {
+            if (is_same(old_type, new_type)) {
+              return true;
+            }
+            if (has_part && part_end == begin && is_same(part_old, old_type) &&
+                is_same(part_new, new_type)) {
+              part_end = end;
+              return true;
+            }
+            if (has_part && !fn(part_begin, part_end, part_old, part_new)) {
+              is_stopped = true;
+              return false;
+            }
+            has_part = true;
+            part_begin = begin;
+            part_end = end;
+            part_old = old_type;
+            part_new = new_type;
+            return true;
+          });
+    if (has_part && !is_stopped) {
+      fn(part_begin, part_end, part_old, part_new);
+    }
+  }
+
+  // Unmap [addr, addr + size): entries inside are erased, entries on the
+  // borders are trimmed or split. kUnknownSize size clears up to the end of
+  // the address space, so does a size that runs past it. An unknown size
+  // tail after the range keeps its unknown size. O(log n + k) for k erased
+  // entries.
+  void RemoveRange(size_type addr, size_type size);
+
+  // Same as AddRange, but the newest range wins: [addr, addr + size) is
+  // removed first, then the range is added and merged with neighbours of
+  // the same type. The range must not wrap around the address space.
+  // O(log n + k) for k replaced entries.
+  void AssignRange(range_type type, size_type addr, size_type size);
+
   // If addr belongs to some entry, fill type and size for this entry
   bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
 
-  // Return true if there are no gaps for [addr, addr + size]
+  // Batched TryGetEntry: for every mapped addrs[i] fill types[i], sizes[i] and
+  // set bit i in found (BitmaskWords(addrs.size()) words). Sorted batches are
+  // resolved with one sweep over entries. Return number of mapped addresses.
+  size_t TryGetEntries(Span<const size_type> addrs, Span<range_type> types,
+                       Span<size_type> sizes, Span<uint64_t> found) const;
+
+  // Return true if there are no gaps for [addr, addr + size]. A size that
+  // runs past the end of the address space is clipped there. O(log n) for
+  // any number of entries in the range.
   bool IsRangeCovered(size_type addr, size_type size) const;
 
-  // True if there are no gaps in mapping
+  // If some part of [addr, addr + size) is not covered, fill its first
+  // address. O(log n).
+  bool FindFirstUncovered(size_type addr, size_type size,
+                          size_type *uncovered) const;
+
+  // True if there are no gaps in mapping and no unknown size entry. Empty
+  // mapping is continuous. O(1).
   bool IsContinious() const;
 
+  // Number of gaps between the first and the last entry. O(1).
+  size_t GapCount() const;
+
+  // Bytes from the begin of the first entry to the end of the last one,
+  // kUnknownSize with an unknown size entry, 0 for empty mapping. O(1).
+  size_type GetSpan() const;
+
+  // Coverage counters below leave out the unknown size entry, its type and
+  // begin are reported by TryGetUnknownTail. All of them are O(1).
+
+  // Bytes covered by entries of the type
+  size_type CoveredBytes(range_type type) const;
+
+  // Number of entries of the type
+  size_t EntryCount(range_type type) const;
+
+  // Bytes covered by all entries
+  size_type TotalCoveredBytes() const { return covered_bytes_; }
+
+  // If mapping ends with an unknown size entry, fill its type and begin
+  bool TryGetUnknownTail(range_type *type, size_type *addr) const;
+
+  // Call fn(gap_addr, gap_size) for every uncovered part of
+  // [addr, addr + size) in address order, stop when fn returns false.
+  // kUnknownSize size, or one that runs past it, goes up to the end of the
+  // address space.
+  template <class F>
+  void ForEachGap(size_type addr, size_type size, F &&fn) const {
+    RANGEMAP_STATS_TIMER(kForEachGap);
+    size_type end = IsUnknownSize(size) ? kUnknownSize : ClipEnd(addr, size);
+    auto it = GetContainingOrNext(addr);
+    while (addr < end) {
+      if (!IsEnd(it) && GetBegin(it) <= addr) {
+        if (IsUnknownSize(it)) {
+          return;
+        }
+        addr = GetEnd(it);
+        ++it;
+        continue;
+      }
+      size_type gap_end = IsEnd(it) ? end : std::min(end, GetBegin(it));
+      if (!fn(addr, gap_end - addr)) {
+        return;
+      }
+      addr = gap_end;
+    }
+  }
+
+  // Call fn(begin, end, type) for every entry that overlaps
+  // [addr, addr + size) in address order, stop when fn returns false.
+  // kUnknownSize size, or one that runs past it, goes up to the end of the
+  // address space, zero size visits nothing. One search for addr, then the
+  // walk over neighbours.
+  template <class F>
+  void ForEachInRange(size_type addr, size_type size, F &&fn) const {
+    RANGEMAP_STATS_TIMER(kForEachInRange);
+    if (size == 0) {
+      return;
+    }
+    size_type end = IsUnknownSize(size) ? kUnknownSize : ClipEnd(addr, size);
+    for (auto it = GetContainingOrNext(addr); !IsEnd(it) && GetBegin(it) < end;
+         ++it) {
+      if (!fn(GetBegin(it), GetEndStrict(it), range_type(GetType(it)))) {
+        return;
+      }
+    }
+  }
+
+  // First free space of at least min_size bytes at or after hint: fill its
+  // addr and the size up to the next entry (kUnknownSize - addr after the
+  // last one). O(log n).
+  bool FindGapAtLeast(size_type min_size, size_type *addr, size_type *size,
+                      size_type hint = 0) const;
+
+  // Build read-only copy with cache friendly lookup
+  FrozenRangeMap Freeze() const;
+
+  // Write sorted entries into a file for MappedRangeMap::Open(). The file is
+  // replaced atomically. Return false on IO error.
+  bool SaveTo(const std::string &path) const;
+
  private:
-  typedef std::map<size_type, Entry> Map;
+  typedef std::pair<const addr_type, Entry> Value;
+  typedef std::map<addr_type, Entry, std::less<addr_type>,
+                   PoolAllocator<Value>>
+      Map;
+  // Estimate of the tree node: value and the node header (color, parent,
+  // left, right). Bigger nodes go to upstream directly.
+  static const size_t kNodeSize = sizeof(Value) + 4 * sizeof(void *);
+
+ public:
+  // Lookup cursor for local address streams. Remembers the last entry and
+  // checks it and a few neighbours before the search from the root, so
+  // sequential or nearby lookups are O(1) amortized. Any change of the map
+  // makes the cursor start over. The map must outlive the cursor.
+  class Cursor {
+   public:
+    explicit Cursor(const BasicRangeMap &map);
+
+    // Same as RangeMap::TryGetEntry
+    bool TryGetEntry(size_type addr, range_type *type, size_type *size);
+
+    // Same as RangeMap::IsRangeCovered
+    bool IsRangeCovered(size_type addr, size_type size);
+
+    // Lookups resolved near the last entry / with the full search
+    size_t HitCount() const { return hits_; }
+    size_t MissCount() const { return misses_; }
+
+   private:
+    // Entry that contains addr or the next one
+    typename Map::const_iterator Seek(size_type addr);
+
+    const BasicRangeMap *map_;
+    typename Map::const_iterator it_;
+    uint64_t version_;
+    size_t hits_;
+    size_t misses_;
+  };
+
+  // Entries in address order as EntryView values. Invalidated by changes of
+  // the map, as iterators of std::map.
+  class const_iterator {
+   public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef EntryView value_type;
+    typedef EntryView reference;
+    typedef void pointer;
+    typedef std::ptrdiff_t difference_type;
+
+    const_iterator() {}
+
+    EntryView operator*() const {
+      size_type end = (it_->second.size == kUnknownSize)
+                          ? kUnknownSize
+                          : it_->first + it_->second.size;
+      return {it_->first, end, it_->second.type};
+    }
+
+    const_iterator &operator++() {
+      ++it_;
+      return *this;
+    }
+    const_iterator operator++(int) { return const_iterator(it_++); }
+    const_iterator &operator--() {
+      --it_;
+      return *this;
+    }
+    const_iterator operator--(int) { return const_iterator(it_--); }
+
+    bool operator==(const const_iterator &other) const {
+      return it_ == other.it_;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return it_ != other.it_;
+    }
+
+   private:
+    friend class BasicRangeMap;
+    explicit const_iterator(typename Map::const_iterator it) : it_(it) {}
+
+    typename Map::const_iterator it_;
+  };
+
+  const_iterator begin() const { return const_iterator(map_.begin()); }
+  const_iterator end() const { return const_iterator(map_.end()); }
+
+  // Entries that overlap [addr, addr + size), see ForEachInRange. The end
+  // costs one more search, prefer ForEachInRange in hot loops.
+  IteratorRange<const_iterator> EntriesInRange(size_type addr,
+                                               size_type size) const;
+
+ private:
+
+  // IsContinious by walk over all entries, cross-check with
+  // RANGEMAP_EXPENSIVE_CHECKS
+  bool IsContiniousSlow() const;
 
   template <class T>
-  bool MaybeMergeEntry(T it, size_type type, size_type addr, size_type size);
+  bool MaybeMergeEntry(T it, size_type type, size_type addr, size_type size,
+                       T *merged);
 
+  // Return entry that covers addr after insertion (may be merged one)
   template <class T>
-  void AddEntry(T it, size_type type, size_type addr, size_type size);
+  T AddEntry(T it, size_type type, size_type addr, size_type size);
 
   void AddRangeUnknownSize(size_type type, size_type addr);
   void AddRangeFixedSize(size_type type, size_type addr, size_type size);
 
+  // RemoveRange for [addr, end), return the first entry after the range
+  typename Map::iterator EraseRange(size_type addr, size_type end);
+
+  // Bulk insert of fixed size ranges that end before the unknown size tail
+  void AddRangesFixedSize(const RangeSpec *ranges, size_t count,
+                          bool is_sorted);
+
+  // Call fn(begin, end, a_type, b_type) for every part of the address space
+  // covered by a or b where the covering entries do not change, in address
+  // order. Type is null if the map does not cover the part. Stop when fn
+  // returns false. Both maps are walked once, no tree searches.
+  template <class F>
+  static void Sweep(const BasicRangeMap &a, const BasicRangeMap &b, F &&fn) {
+    auto ia = a.map_.begin();
+    auto ib = b.map_.begin();
+    // Everything before pos is visited
+    size_type pos = 0;
+    while (true) {
+      while (!a.IsEnd(ia) && a.GetEnd(ia) <= pos) {
+        ++ia;
+      }
+      while (!b.IsEnd(ib) && b.GetEnd(ib) <= pos) {
+        ++ib;
+      }
+      if (a.IsEnd(ia) && b.IsEnd(ib)) {
+        return;
+      }
+      bool in_a = !a.IsEnd(ia) && a.GetBegin(ia) <= pos;
+      bool in_b = !b.IsEnd(ib) && b.GetBegin(ib) <= pos;
+      if (!in_a && !in_b) {
+        pos = a.IsEnd(ia)   ? b.GetBegin(ib)
+              : b.IsEnd(ib) ? a.GetBegin(ia)
+                            : std::min(a.GetBegin(ia), b.GetBegin(ib));
+        continue;
+      }
+      // Part ends where any of the maps changes
+      size_type end = kUnknownSize;
+      if (!a.IsEnd(ia)) {
+        end = std::min(end, in_a ? a.GetEnd(ia) : a.GetBegin(ia));
+      }
+      if (!b.IsEnd(ib)) {
+        end = std::min(end, in_b ? b.GetEnd(ib) : b.GetBegin(ib));
+      }
+      if (!fn(pos, end, in_a ? &ia->second.type : nullptr,
+              in_b ? &ib->second.type : nullptr) ||
+          end == kUnknownSize) {
+        return;
+      }
+      pos = end;
+    }
+  }
+
+  // Put sorted disjoint fixed size EntryViews into gaps of the mapping in
+  // one walk, all of them must end before the unknown size tail
+  template <class It>
+  void FillGaps(It first, It last);
+
+  // Last entry has unknown size
+  bool HasUnknownTail() const {
+    return !map_.empty() && IsUnknownSize(std::prev(map_.end()));
+  }
+
   // If size is unknown, return kUnknownSize;
   // TODO: Replace with strict version?
   template <class T>
@@ -109,11 +502,43 @@ class RangeMap {
     return it->second.type;
   }
 
+  // Unknown size absorbs any other size
   template <class T>
   void AddSize(T it, size_type added) {
     CHECK(!IsEnd(it));
-    CHECK(!IsUnknownSize(added));
-    it->second.size += added;
+    if (IsUnknownSize(it) || IsUnknownSize(added)) {
+      SetEntrySize(it, kUnknownSize);
+    } else {
+      SetEntrySize(it, GetSize(it) + added);
+    }
+  }
+
+  // All size changes of existing entries go here to keep counters
+  template <class T>
+  void SetEntrySize(T it, size_type size) {
+    CHECK(!IsEnd(it));
+    UncountEntry(GetType(it), GetSize(it));
+    it->second.size = size;
+    CountEntry(GetType(it), size);
+  }
+
+  // Add or remove entry from the coverage counters
+  void CountEntry(range_type type, size_type size) {
+    if (!IsUnknownSize(size)) {
+      TypeStats &stats = stats_[type];
+      stats.bytes += size;
+      ++stats.entries;
+      covered_bytes_ += size;
+    }
+  }
+  void UncountEntry(range_type type, size_type size) {
+    if (!IsUnknownSize(size)) {
+      auto it = stats_.find(type);
+      CHECK(it != stats_.end() && it->second.entries != 0);
+      --it->second.entries;
+      it->second.bytes -= size;
+      covered_bytes_ -= size;
+    }
   }
 
   template <class T>
@@ -125,17 +550,28 @@ class RangeMap {
     if (GetBegin(it) == new_addr) {
       return;
     }
+    // Position is not changed, so reinsert with hint is amortized O(1)
+    RANGEMAP_STATS_COUNT(kEntryMove, 1);
+    auto hint = std::next(it);
     auto extr = map_.extract(it);
     extr.key() = new_addr;
-    map_.insert(std::move(extr));
+    map_.insert(hint, std::move(extr));
   }
 
   // Get entry that contains addr or the next one
-  Map::const_iterator GetContainingOrNext(size_type addr) const;
-  Map::iterator GetContainingOrNext(size_type addr);
+  typename Map::const_iterator GetContainingOrNext(size_type addr) const;
+  typename Map::iterator GetContainingOrNext(size_type addr);
 
   // Get entry that contains addr or end() otherwise
-  Map::const_iterator GetContaining(size_type addr) const;
+  typename Map::const_iterator GetContaining(size_type addr) const;
+
+  // Same as GetContainingOrNext, but addr should not go before 'it'. Walks
+  // forward a few entries before falling back to the tree search.
+  typename Map::const_iterator AdvanceToContainingOrNext(
+      typename Map::const_iterator it, size_type addr) const;
+  typename Map::iterator AdvanceToContainingOrNext(typename Map::iterator it,
+                                                   size_type addr);
+  static const size_t kMaxSweepSteps = 8;
 
   // True if 'it' has addr
   template <class T>
@@ -169,14 +605,60 @@ class RangeMap {
   template <class T>
   void VerifyEntry(T it) const;
 
-  // Find first gap between start and end, return map_.end() if none
-  template <class T>
-  T FindFirstGap(T start, T end) const;
+  // Gap index follows every change of covered space
+  void CoverGap(size_type addr, size_type size) {
+    gaps_.Cover(addr, IsUnknownSize(size) ? kUnknownSize : addr + size);
+  }
+
+  struct TypeStats {
+    size_type bytes = 0;
+    size_t entries = 0;
+  };
+  typedef std::unordered_map<
+      range_type, TypeStats, std::hash<range_type>, std::equal_to<range_type>,
+      ResourceAllocator<std::pair<const range_type, TypeStats>>>
+      Stats;
+
+  // Pool of a moved-from map, it has no entries
+  void MakePool() {
+    CHECK(map_.empty());
+    pool_.reset(new NodePool(kNodeSize, upstream_));
+    map_ = Map(PoolAllocator<Value>(pool_.get()));
+  }
 
   friend class RangeMapTest;
+  friend class ShardedRangeMap;
+  std::pmr::memory_resource *upstream_;
+  // Goes before map_, nodes are freed first. Null after move.
+  std::unique_ptr<NodePool> pool_;
   Map map_;
+  GapIndex<size_type> gaps_;
+  // Coverage of every type that had entries, see CoveredBytes. Counters
+  // stay at zero when the last entry goes, so types that come back do not
+  // allocate again.
+  Stats stats_;
+  size_type covered_bytes_;
+  // Changed by every update, cursors compare it with their own
+  uint64_t version_;
 };
 
+template <class AddrT, class SizeT, class TypeT>
+const SizeT BasicRangeMap<AddrT, SizeT, TypeT>::kUnknownSize;
+template <class AddrT, class SizeT, class TypeT>
+const SizeT BasicRangeMap<AddrT, SizeT, TypeT>::kNoRelative;
+template <class AddrT, class SizeT, class TypeT>
+const size_t BasicRangeMap<AddrT, SizeT, TypeT>::kNodeSize;
+template <class AddrT, class SizeT, class TypeT>
+const size_t BasicRangeMap<AddrT, SizeT, TypeT>::kMaxSweepSteps;
+
+// Instantiated in rangemap.cc
+extern template class BasicRangeMap<uint64_t, uint64_t, size_t>;
+extern template class BasicRangeMap<uint32_t, uint32_t, uint8_t>;
+
+typedef BasicRangeMap<uint64_t, uint64_t, size_t> RangeMap;
+// 32-bit addresses and up to 256 types
+typedef BasicRangeMap<uint32_t, uint32_t, uint8_t> CompactRangeMap;
+
 }  // namespace rangemap
 
 #endif  // RANGEMAP_INCLUDE_H
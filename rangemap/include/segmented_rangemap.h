@@ -0,0 +1,92 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_SEGMENTED_RANGEMAP_INCLUDE_H
+#define RANGEMAP_SEGMENTED_RANGEMAP_INCLUDE_H
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// RangeMap with relocatable segments, e.g. sections of loaded modules.
+//
+// A segment is a window [base, base + size) with its own RangeMap of
+// offsets. Rebase() moves the window and does not touch the entries, so a
+// module with many ranges is relocated in O(log s) for s segments. Lookups
+// find the segment of the address in the table of segment bases first.
+// Addresses inside a segment resolve only through it, other addresses go to
+// the map of absolute ranges. Segments never overlap each other.
+class SegmentedRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  typedef uint32_t segment_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+
+  SegmentedRangeMap() = default;
+  // Copy points its bases to its own segments. Moves take the segment nodes
+  // along, so the bases stay valid.
+  SegmentedRangeMap(const SegmentedRangeMap &other);
+  SegmentedRangeMap(SegmentedRangeMap &&other) = default;
+  SegmentedRangeMap &operator=(const SegmentedRangeMap &other);
+  SegmentedRangeMap &operator=(SegmentedRangeMap &&other) = default;
+
+  // Same as RangeMap::AddRange. Parts inside segments are hidden by them.
+  void AddRange(range_type type, size_type addr, size_type size);
+
+  // New empty segment [base, base + size). Return false if the id is used,
+  // the window wraps around the address space or overlaps another segment.
+  bool AddSegment(segment_type segment, size_type base, size_type size);
+
+  // Drop the segment with its ranges
+  void RemoveSegment(segment_type segment);
+
+  // Same as RangeMap::AddRange with offsets from the segment base, the
+  // range must fit into the segment
+  void AddSegmentRange(segment_type segment, range_type type,
+                       size_type offset, size_type size);
+
+  // Move the segment to new_base, entries keep their offsets. Return false
+  // if the window would wrap around or overlap another segment. O(log s).
+  bool Rebase(segment_type segment, size_type new_base);
+
+  bool HasSegment(segment_type segment) const {
+    return segments_.count(segment) != 0;
+  }
+  size_type GetBase(segment_type segment) const;
+  size_t SegmentCount() const { return segments_.size(); }
+
+  // Same as RangeMap, addresses are absolute
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+  bool IsRangeCovered(size_type addr, size_type size) const;
+
+ private:
+  struct Segment {
+    size_type base;
+    size_type size;
+    RangeMap map;
+  };
+  typedef std::map<size_type, Segment *> Bases;
+
+  // Segment that contains addr or the next one
+  Bases::const_iterator FindSegment(size_type addr) const;
+
+  // No segment other than ignored takes a part of [base, base + size)
+  bool IsWindowFree(size_type base, size_type size,
+                    const Segment *ignored) const;
+
+  Segment &GetSegment(segment_type segment);
+
+  // Fill bases_ from segments_
+  void RebuildBases();
+
+  RangeMap map_;
+  // Elements keep their addresses on rehash
+  std::unordered_map<segment_type, Segment> segments_;
+  Bases bases_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_SEGMENTED_RANGEMAP_INCLUDE_H
@@ -0,0 +1,115 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_SHARDED_RANGEMAP_INCLUDE_H
+#define RANGEMAP_SHARDED_RANGEMAP_INCLUDE_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "rangemap.h"
+
+namespace rangemap {
+
+// Thread safe RangeMap split by address into shards, each with its own lock.
+//
+// Ranges that cross shard borders are split, so no entry crosses a border;
+// lookups join neighbour entries of the same type back, answers are the
+// same as for one RangeMap with the same AddRange calls.
+//
+// Unknown size tail is kept outside the shards and changes only with all
+// shards locked, so holding any shard lock is enough to read it. Fixed size
+// ranges that end before the tail lock only the shards they touch, writers
+// in disjoint shards share no lock. Unknown size ranges and ranges that
+// reach the tail lock all shards.
+class ShardedRangeMap {
+ public:
+  typedef RangeMap::size_type size_type;
+  typedef RangeMap::range_type range_type;
+  static const size_type kUnknownSize = RangeMap::kUnknownSize;
+
+  // Shard i has addresses [split_points[i - 1], split_points[i]), split
+  // points must be sorted and unique
+  explicit ShardedRangeMap(const std::vector<size_type> &split_points);
+
+  // Split points for 2^bits shards by the high bits of the address
+  static std::vector<size_type> SplitByHighBits(unsigned bits);
+
+  // Same as RangeMap, thread safe
+  void AddRange(range_type type, size_type addr, size_type size);
+  void AddRangeRel(range_type type, size_type addr, size_type size,
+                   size_type rel_addr);
+  bool TryGetEntry(size_type addr, range_type *type, size_type *size) const;
+  bool IsRangeCovered(size_type addr, size_type size) const;
+  bool IsContinious() const;
+
+  size_t ShardCount() const { return shards_.size(); }
+
+ private:
+  struct Shard {
+    mutable std::mutex mutex;
+    RangeMap map;
+  };
+
+  // Maximal range of joined same type entries
+  struct Run {
+    size_type begin;
+    size_type end;
+    range_type type;
+  };
+
+  // Locks shards [lo, hi] in ascending order
+  class ShardLock {
+   public:
+    ShardLock(const ShardedRangeMap *owner, size_t lo, size_t hi);
+    ~ShardLock();
+
+   private:
+    const ShardedRangeMap *owner_;
+    size_t lo_;
+    size_t hi_;
+  };
+
+  size_t ShardOf(size_type addr) const;
+  size_type ShardBegin(size_t shard) const;
+  // kUnknownSize for the last shard
+  size_type ShardEnd(size_t shard) const;
+
+  // Add [begin, end) to every shard it touches, fills gaps only
+  void FillShards(range_type type, size_type begin, size_type end);
+
+  // Run that contains addr, looks only in locked shards [lo, hi]. If the run
+  // may continue in the next unlocked shard, extend *want_lo / *want_hi.
+  bool FindRun(size_type addr, size_t lo, size_t hi, Run *run,
+               size_t *want_lo, size_t *want_hi) const;
+
+  // First entry begin >= addr, the tail included. Whole map is locked.
+  bool FindNextBegin(size_type addr, size_type *begin) const;
+
+  // kUnknownSize if there is no tail
+  size_type TailBegin() const {
+    return tail_begin_.load(std::memory_order_relaxed);
+  }
+  bool HasTail() const { return TailBegin() != kUnknownSize; }
+
+  // Whole map is locked for the rest
+  void SetTail(range_type type, size_type begin);
+  void ClearTail() {
+    tail_begin_.store(kUnknownSize, std::memory_order_release);
+  }
+  void EraseRun(const Run &run);
+  void MaybeAbsorbIntoTail();
+  void AddRangeUnknownSizeLocked(range_type type, size_type addr);
+  void AddRangeFixedSizeLocked(range_type type, size_type begin,
+                               size_type end);
+
+  std::vector<size_type> split_points_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  // Atomic for the unlocked check in AddRange
+  range_type tail_type_;
+  std::atomic<size_type> tail_begin_;
+};
+
+}  // namespace rangemap
+
+#endif  // RANGEMAP_SHARDED_RANGEMAP_INCLUDE_H
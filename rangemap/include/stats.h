@@ -0,0 +1,123 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_STATS_INCLUDE_H
+#define RANGEMAP_STATS_INCLUDE_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace rangemap {
+namespace stats {
+
+// Process-wide counters and latency histograms of all maps. Updates are
+// compiled in only with RANGEMAP_ENABLE_STATS (CMake option of the same
+// name), otherwise the macros below are empty and everything stays zero.
+#ifdef RANGEMAP_ENABLE_STATS
+const bool kIsEnabled = true;
+#else
+const bool kIsEnabled = false;
+#endif
+
+enum Event {
+  kMergeNext,        // New range joined the next entry
+  kMergePrev,        // New range joined the previous entry
+  kMergeBoth,        // Range closed the gap, next entry is dropped
+  kEntryMove,        // SetEntryAddress extracted and reinserted a node
+  kFixedSizeStep,    // Loop step of AddRangeFixedSize
+  kEraseEntry,       // Entry dropped by RemoveRange or AssignRange
+  kCursorCoverStep,  // Entry visited by Cursor::IsRangeCovered
+  kEventCount
+};
+
+// Timed methods of RangeMap and its Cursor. ForEachGap and ForEachInRange
+// include the time of the callback. Not timed: O(1) accessors, iterators,
+// GapCount, GetSpan, and whole-map builders (ParallelBuild, Intersect,
+// Subtract, Diff, Freeze) that run once per map, their updates count under
+// the ops above.
+enum Op {
+  kAddRange,
+  kAddRanges,
+  kTryAddRangeStrict,
+  kRemoveRange,
+  kAssignRange,
+  kTryGetEntry,
+  kTryGetEntries,
+  kIsRangeCovered,
+  kFindGapAtLeast,
+  kMerge,
+  kFindFirstUncovered,
+  kCursorTryGetEntry,
+  kCursorIsRangeCovered,
+  kForEachGap,
+  kForEachInRange,
+  kIsContinious,
+  kSaveTo,
+  kOpCount
+};
+
+// Bucket i has latencies in (2^(i-1), 2^i] ns, bucket 0 has 0 and 1 ns, the
+// last one has everything above 2^(kBucketCount-2) ns
+const size_t kBucketCount = 48;
+
+void Count(Event event, uint64_t n);
+void Record(Op op, uint64_t ns);
+
+uint64_t GetCount(Event event);
+// Number of calls of op with latency in the bucket
+uint64_t GetBucket(Op op, size_t bucket);
+
+void Reset();
+
+// Measure the scope and add it to the histogram of op. Only the outermost
+// timer of the thread records, so public methods that call each other
+// (AddRanges, Merge -> AddRange) count once.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Op op) : op_(op), is_outer_(depth_++ == 0) {
+    if (is_outer_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+  ~ScopedTimer() {
+    --depth_;
+    if (is_outer_) {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start_);
+      Record(op_, ns.count());
+    }
+  }
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+ private:
+  static thread_local size_t depth_;
+
+  Op op_;
+  bool is_outer_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace stats
+
+// All counters and histograms in Prometheus text format
+std::string DumpStats();
+
+}  // namespace rangemap
+
+#ifdef RANGEMAP_ENABLE_STATS
+#define RANGEMAP_STATS_COUNT(event, n)                                         \
+  ::rangemap::stats::Count(::rangemap::stats::event, (n))
+#define RANGEMAP_STATS_TIMER(op)                                               \
+  ::rangemap::stats::ScopedTimer rangemap_stats_timer(::rangemap::stats::op)
+#else
+#define RANGEMAP_STATS_COUNT(event, n)                                         \
+  do {                                                                         \
+  } while (0)
+#define RANGEMAP_STATS_TIMER(op)                                               \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#endif  // RANGEMAP_STATS_INCLUDE_H
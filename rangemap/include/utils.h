@@ -2,13 +2,100 @@
 #define RANGEMAP_UTILS_INCLUDE_H
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 
 namespace rangemap {
 
+#ifdef NDEBUG
+// Not evaluated, but variables used only in checks stay used
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    (void)sizeof(!(expr));                                                     \
+  } while (0)
+#else
 #define CHECK(expr)                                                            \
   do {                                                                         \
     assert(expr);                                                              \
   } while (0)
+#endif
+
+// Non-owning view of contiguous elements (std::span is C++20)
+template <class T>
+class Span {
+ public:
+  Span() : data_(nullptr), size_(0) {}
+  Span(T *data, size_t size) : data_(data), size_(size) {}
+  // Any container with data() and size(), e.g. std::vector
+  template <class C>
+  Span(C &&container) : data_(container.data()), size_(container.size()) {}
+
+  T *data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  T &operator[](size_t i) const {
+    CHECK(i < size_);
+    return data_[i];
+  }
+  T *begin() const { return data_; }
+  T *end() const { return data_ + size_; }
+
+ private:
+  T *data_;
+  size_t size_;
+};
+
+// Pair of iterators for range-based for
+template <class It>
+class IteratorRange {
+ public:
+  IteratorRange(It first, It last) : first_(first), last_(last) {}
+
+  It begin() const { return first_; }
+  It end() const { return last_; }
+  bool empty() const { return first_ == last_; }
+
+ private:
+  It first_;
+  It last_;
+};
+
+// End of [addr, addr + size), a range that runs past the end of the address
+// space is clipped there
+template <class T>
+inline T ClipEnd(T addr, T size) {
+  T end = addr + size;
+  return (end < addr) ? std::numeric_limits<T>::max() : end;
+}
+
+// Bitmask for n elements packed into 64-bit words
+inline size_t BitmaskWords(size_t count) { return (count + 63) / 64; }
+
+inline void SetBit(Span<uint64_t> mask, size_t i) {
+  mask[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+inline bool GetBit(Span<const uint64_t> mask, size_t i) {
+  return (mask[i / 64] >> (i % 64)) & 1;
+}
+
+// Index of the first element in sorted [first, first + count) that goes after
+// value (or count). Loop has fixed trip count and no unpredictable branches,
+// compiler emits cmov for the step.
+template <class T>
+inline size_t UpperBound(const T *first, size_t count, T value) {
+  if (count == 0) {
+    return 0;
+  }
+  const T *base = first;
+  while (count > 1) {
+    size_t half = count / 2;
+    base = (base[half] <= value) ? base + half : base;
+    count -= half;
+  }
+  return (base - first) + (*base <= value);
+}
 
 } // namespace rangemap
 
@@ -0,0 +1,113 @@
+#include "concurrent_rangemap.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace rangemap {
+
+const size_t ConcurrentRangeMap::kMaxReaders;
+
+ConcurrentRangeMap::ConcurrentRangeMap() : current_(new RangeMap()) {}
+
+ConcurrentRangeMap::~ConcurrentRangeMap() {
+  for (const auto &slot : slots_) {
+    CHECK(!slot.is_used.load());
+  }
+  delete current_.load();
+  for (const RangeMap *map : retired_) {
+    delete map;
+  }
+}
+
+ConcurrentRangeMap::Reader::~Reader() {
+  if (slot_ != nullptr) {
+    CHECK(slot_->hazard.load() == nullptr);
+    slot_->is_used.store(false, std::memory_order_release);
+  }
+}
+
+ConcurrentRangeMap::Reader::Guard::Guard(const Reader *reader_)
+    : reader(reader_) {
+  // Not an assert: running out of slots is not a bug of the caller, but
+  // reading without a slot is
+  if (!reader->IsValid()) {
+    std::abort();
+  }
+  // Announce the version and check it is still current, otherwise the writer
+  // could miss the announce and free it
+  map = reader->owner_->current_.load(std::memory_order_acquire);
+  while (true) {
+    reader->slot_->hazard.store(map, std::memory_order_seq_cst);
+    const RangeMap *again =
+        reader->owner_->current_.load(std::memory_order_seq_cst);
+    if (again == map) {
+      break;
+    }
+    map = again;
+  }
+}
+
+ConcurrentRangeMap::Reader::Guard::~Guard() {
+  reader->slot_->hazard.store(nullptr, std::memory_order_release);
+}
+
+ConcurrentRangeMap::Reader ConcurrentRangeMap::GetReader() {
+  for (auto &slot : slots_) {
+    bool expected = false;
+    if (!slot.is_used.load(std::memory_order_relaxed) &&
+        slot.is_used.compare_exchange_strong(expected, true,
+                                             std::memory_order_acquire)) {
+      return Reader(this, &slot);
+    }
+  }
+  return Reader(this, nullptr);
+}
+
+void ConcurrentRangeMap::AddRange(range_type type, size_type addr,
+                                  size_type size) {
+  pending_.push_back({type, addr, size});
+}
+
+void ConcurrentRangeMap::AddRangeRel(range_type type, size_type addr,
+                                     size_type size, size_type rel_addr) {
+  CHECK(rel_addr != RangeMap::kNoRelative);
+  // TODO: check overflow
+  CHECK(rel_addr + addr >= addr);
+  AddRange(type, addr + rel_addr, size);
+}
+
+void ConcurrentRangeMap::Publish() {
+  if (pending_.empty()) {
+    return;
+  }
+  // Only the writer changes current_
+  RangeMap *next = new RangeMap(*current_.load(std::memory_order_relaxed));
+  next->AddRanges(pending_);
+  pending_.clear();
+
+  const RangeMap *prev = current_.exchange(next, std::memory_order_seq_cst);
+  retired_.push_back(prev);
+  Reclaim();
+}
+
+void ConcurrentRangeMap::Reclaim() {
+  std::vector<const RangeMap *> hazards;
+  for (const auto &slot : slots_) {
+    const RangeMap *map = slot.hazard.load(std::memory_order_seq_cst);
+    if (map != nullptr) {
+      hazards.push_back(map);
+    }
+  }
+  std::sort(hazards.begin(), hazards.end());
+
+  auto try_free = [&](const RangeMap *map) {
+    if (std::binary_search(hazards.begin(), hazards.end(), map)) {
+      return false;
+    }
+    delete map;
+    return true;
+  };
+  retired_.erase(std::remove_if(retired_.begin(), retired_.end(), try_free),
+                 retired_.end());
+}
+
+}  // namespace rangemap
@@ -0,0 +1,225 @@
+#include "flat_rangemap.h"
+
+namespace rangemap {
+
+const FlatRangeMap::size_type FlatRangeMap::kUnknownSize;
+const FlatRangeMap::size_type FlatRangeMap::kNoRelative;
+
+void FlatRangeMap::AddRange(range_type type, size_type addr, size_type size) {
+  if (size == 0) {
+    return;
+  }
+  if (IsUnknownSize(size)) {
+    AddRangeUnknownSize(type, addr);
+  } else {
+    AddRangeFixedSize(type, addr, size);
+  }
+}
+
+void FlatRangeMap::AddRangeRel(range_type type, size_type addr,
+                               size_type size, size_type rel_addr) {
+  CHECK(rel_addr != kNoRelative);
+  // TODO: check overflow
+  CHECK(rel_addr + addr >= addr);
+  AddRange(type, addr + rel_addr, size);
+}
+
+void FlatRangeMap::Reserve(size_t count) {
+  begins_.reserve(count);
+  entries_.reserve(count);
+}
+
+size_t FlatRangeMap::AddEntry(size_t pos, range_type type, size_type addr,
+                              size_type size) {
+  if (size == 0) return pos;
+
+  if (!IsUnknownSize(size)) {
+    CHECK(addr + size >= addr);
+  }
+
+  if (!IsEnd(pos)) {
+    CHECK(GetBegin(pos) > addr);
+  }
+
+  // Same merging rules as RangeMap::MaybeMergeEntry
+  bool merge_next = !IsEnd(pos) && (type == GetType(pos)) &&
+                    !IsUnknownSize(size) && (GetBegin(pos) == addr + size);
+  bool merge_prev =
+      (pos != 0) && (type == GetType(pos - 1)) && (GetEnd(pos - 1) == addr);
+
+  if (merge_prev) {
+    AddSize(pos - 1, size);
+    if (merge_next) {
+      // Collapse with the next region
+      AddSize(pos - 1, GetSize(pos));
+      begins_.erase(begins_.begin() + pos);
+      entries_.erase(entries_.begin() + pos);
+    }
+    return pos - 1;
+  }
+
+  if (merge_next) {
+    AddSize(pos, size);
+    begins_[pos] = addr;
+    return pos;
+  }
+
+  begins_.insert(begins_.begin() + pos, addr);
+  entries_.insert(entries_.begin() + pos, Entry(type, size));
+  return pos;
+}
+
+void FlatRangeMap::AddRangeUnknownSize(range_type type, size_type addr) {
+  // Can spawn only 1 range, maybe fix prev entry size
+  size_t pos = GetContainingOrNext(addr);
+  size_type base_beg = addr;
+  size_type base_size = kUnknownSize;
+
+  if (!IsEnd(pos)) {
+    if (IsEntryContains(pos, addr)) {
+      size_t next = pos + 1;
+      if (IsEnd(next)) {
+        MaybeUpdateUnknownSize(pos, base_beg);
+      } else {
+        base_size = GetBegin(next) - GetEnd(pos);
+      }
+      size_type pos_end = GetEnd(pos);
+      // Mapping unknown size on top of unknown size
+      if (IsUnknownSize(pos_end)) {
+        return;
+      }
+      base_beg = pos_end;
+      ++pos;
+    } else {
+      // 'pos' is the next enrty, calc new fixed size
+      base_size = GetBegin(pos) - addr;
+    }
+  }
+
+  AddEntry(pos, type, base_beg, base_size);
+}
+
+void FlatRangeMap::AddRangeFixedSize(range_type type, size_type addr,
+                                     size_type size) {
+  CHECK(!IsUnknownSize(size));
+  size_t pos = GetContainingOrNext(addr);
+
+  size_type base_beg = addr;
+  size_type base_end = addr + size;
+  CHECK(base_end > base_beg);
+  while (true) {
+    if (IsEnd(pos)) {
+      AddEntry(pos, type, base_beg, base_end - base_beg);
+      break;
+    } else {
+      VerifyEntry(pos);
+      if (IsEntryContains(pos, base_beg)) {
+        if (IsUnknownEntry(pos)) {
+          if (GetBegin(pos) == base_beg) {
+            entries_[pos].size = base_end - base_beg;
+            base_beg = base_end;
+          } else {
+            entries_[pos].size = base_beg - GetBegin(pos);
+          }
+        } else {
+          base_beg = GetEnd(pos);
+        }
+      } else {
+        size_type next_beg = GetBegin(pos);
+        if (base_end > next_beg) {
+          pos = AddEntry(pos, type, base_beg, next_beg - base_beg);
+          base_beg = GetEnd(pos);
+        } else {
+          AddEntry(pos, type, base_beg, base_end - base_beg);
+          return;
+        }
+      }
+      ++pos;
+    }
+
+    if (base_beg >= base_end) {
+      break;
+    }
+  }
+}
+
+bool FlatRangeMap::TryGetEntry(size_type addr, range_type *type,
+                               size_type *size) const {
+  CHECK(!IsUnknownSize(addr));
+  size_t pos = GetContaining(addr);
+  if (IsEnd(pos)) {
+    return false;
+  }
+  *type = GetType(pos);
+  *size = GetSize(pos);
+  return true;
+}
+
+bool FlatRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(!IsUnknownSize(size));
+  if (size == 0) {
+    return true;
+  }
+  CHECK(addr + size > addr);
+  size_t pos = GetContainingOrNext(addr);
+  size_type cov_end = addr + size;
+  while (cov_end > addr) {
+    if (IsEnd(pos) || !IsEntryContains(pos, addr)) {
+      return false;
+    }
+    if (IsUnknownEntry(pos)) {
+      return true;
+    }
+    addr = GetEnd(pos);
+    ++pos;
+  }
+  return true;
+}
+
+bool FlatRangeMap::IsContinious() const {
+  if (begins_.empty()) {
+    return true;
+  }
+  size_type prev_end = GetBegin(0);
+  for (size_t pos = 0; pos < Size(); ++pos) {
+    if (IsUnknownEntry(pos) || (GetBegin(pos) != prev_end)) {
+      return false;
+    }
+    prev_end = GetEnd(pos);
+  }
+  return true;
+}
+
+size_t FlatRangeMap::GetContainingOrNext(size_type addr) const {
+  size_t pos = UpperBound(begins_.data(), begins_.size(), addr);
+  if ((pos != 0) && IsEntryContains(pos - 1, addr)) {
+    return pos - 1;
+  }
+  return pos;
+}
+
+size_t FlatRangeMap::GetContaining(size_type addr) const {
+  size_t pos = UpperBound(begins_.data(), begins_.size(), addr);
+  if ((pos == 0) || !IsEntryContains(pos - 1, addr)) {
+    return Size();
+  }
+  return pos - 1;
+}
+
+void FlatRangeMap::MaybeUpdateUnknownSize(size_t pos, size_type next_addr) {
+  CHECK(!IsUnknownSize(next_addr));
+  if (IsUnknownEntry(pos) && (GetBegin(pos) < next_addr)) {
+    entries_[pos].size = next_addr - GetBegin(pos);
+  }
+}
+
+void FlatRangeMap::VerifyEntry(size_t pos) const {
+  if (!IsUnknownEntry(pos)) {
+    CHECK(GetBegin(pos) + GetSize(pos) > GetBegin(pos));
+  }
+  // Pos in mappings
+  CHECK(IsEnd(pos + 1) || GetEnd(pos) <= GetBegin(pos + 1));
+  CHECK((pos == 0) || GetEnd(pos - 1) <= GetBegin(pos));
+}
+
+}  // namespace rangemap
@@ -0,0 +1,251 @@
+#include "frozen_rangemap.h"
+#include <algorithm>
+#include <iterator>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+namespace rangemap {
+
+const FrozenRangeMap::size_type FrozenRangeMap::kUnknownSize;
+const size_t FrozenRangeMap::kFanout;
+const size_t FrozenRangeMap::kGroupSize;
+const size_t FrozenRangeMap::kMaxSweepSteps;
+
+FrozenRangeMap::FrozenRangeMap(std::vector<size_type> begins,
+                               std::vector<range_type> types,
+                               std::vector<size_type> sizes)
+    : types_(std::move(types)), sizes_(std::move(sizes)),
+      is_continious_(true) {
+  CHECK(begins.size() == types_.size());
+  CHECK(begins.size() == sizes_.size());
+  BuildIndex(begins);
+
+  for (size_t pos = 0; pos < Size(); ++pos) {
+    if ((sizes_[pos] == kUnknownSize) ||
+        ((pos != 0) && (GetEnd(pos - 1) != GetBegin(pos)))) {
+      is_continious_ = false;
+      break;
+    }
+  }
+}
+
+void FrozenRangeMap::BuildIndex(const std::vector<size_type> &begins) {
+  if (begins.empty()) {
+    return;
+  }
+  // Padding keys go after any valid address
+  Node pad;
+  std::fill(pad.keys, pad.keys + kFanout, kUnknownSize);
+
+  // Build from the leaves to the root, key of the parent is the max key of
+  // the child node
+  std::vector<size_type> keys = begins;
+  std::vector<std::vector<Node>> levels;
+  while (true) {
+    std::vector<Node> level((keys.size() + kFanout - 1) / kFanout, pad);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      level[i / kFanout].keys[i % kFanout] = keys[i];
+    }
+    levels.push_back(std::move(level));
+    if (keys.size() <= kFanout) {
+      break;
+    }
+    std::vector<size_type> parent_keys;
+    parent_keys.reserve(levels.back().size());
+    for (size_t i = kFanout - 1; i < keys.size(); i += kFanout) {
+      parent_keys.push_back(keys[i]);
+    }
+    if (keys.size() % kFanout != 0) {
+      parent_keys.push_back(keys.back());
+    }
+    keys = std::move(parent_keys);
+  }
+  levels_.assign(std::make_move_iterator(levels.rbegin()),
+                 std::make_move_iterator(levels.rend()));
+}
+
+size_t FrozenRangeMap::CountLessOrEqual(const Node &node, size_type addr) {
+  static_assert(kFanout == 16, "SIMD search expects 16 keys per node");
+#if defined(__AVX2__)
+  // No unsigned 64-bit compare, flip the sign bit and compare signed
+  const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+  const __m256i value = _mm256_xor_si256(_mm256_set1_epi64x(addr), sign);
+  unsigned greater = 0;
+  for (size_t i = 0; i < kFanout / 4; ++i) {
+    __m256i keys = _mm256_load_si256(
+        reinterpret_cast<const __m256i *>(node.keys + i * 4));
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(keys, sign), value);
+    greater |= _mm256_movemask_pd(_mm256_castsi256_pd(gt)) << (i * 4);
+  }
+  return kFanout - __builtin_popcount(greater);
+#elif defined(__SSE4_2__)
+  const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+  const __m128i value = _mm_xor_si128(_mm_set1_epi64x(addr), sign);
+  unsigned greater = 0;
+  for (size_t i = 0; i < kFanout / 2; ++i) {
+    __m128i keys =
+        _mm_load_si128(reinterpret_cast<const __m128i *>(node.keys + i * 2));
+    __m128i gt = _mm_cmpgt_epi64(_mm_xor_si128(keys, sign), value);
+    greater |= _mm_movemask_pd(_mm_castsi128_pd(gt)) << (i * 2);
+  }
+  return kFanout - __builtin_popcount(greater);
+#else
+  size_t count = 0;
+  for (size_t i = 0; i < kFanout; ++i) {
+    count += (node.keys[i] <= addr);
+  }
+  return count;
+#endif
+}
+
+size_t FrozenRangeMap::UpperBound(size_type addr) const {
+  if (Size() == 0 || addr >= GetBegin(Size() - 1)) {
+    return Size();
+  }
+  // Max key of each child is known, so the first child with max key > addr
+  // has the answer. It exists since addr goes before the last begin.
+  size_t pos = 0;
+  for (const auto &level : levels_) {
+    pos = pos * kFanout + CountLessOrEqual(level[pos], addr);
+  }
+  return pos;
+}
+
+void FrozenRangeMap::UpperBoundGroup(const size_type *addrs, size_t count,
+                                     size_t *result) const {
+  CHECK(count <= kGroupSize);
+  if (Size() == 0) {
+    std::fill(result, result + count, Size());
+    return;
+  }
+  // Addresses after the last begin are resolved without the descent
+  const size_type last_begin = GetBegin(Size() - 1);
+  bool descend[kGroupSize];
+  for (size_t i = 0; i < count; ++i) {
+    descend[i] = addrs[i] < last_begin;
+    result[i] = descend[i] ? 0 : Size();
+  }
+  // Level by level, so loads of the whole group are in flight together
+  for (size_t l = 0; l < levels_.size(); ++l) {
+    const auto &level = levels_[l];
+    for (size_t i = 0; i < count; ++i) {
+      if (!descend[i]) {
+        continue;
+      }
+      result[i] =
+          result[i] * kFanout + CountLessOrEqual(level[result[i]], addrs[i]);
+      if (l + 1 < levels_.size()) {
+        __builtin_prefetch(&levels_[l + 1][result[i]]);
+      }
+    }
+  }
+}
+
+size_t FrozenRangeMap::GetContainingOrNext(size_type addr) const {
+  size_t pos = UpperBound(addr);
+  if ((pos != 0) && IsEntryContains(pos - 1, addr)) {
+    return pos - 1;
+  }
+  return pos;
+}
+
+bool FrozenRangeMap::TryGetEntry(size_type addr, range_type *type,
+                                 size_type *size) const {
+  CHECK(addr != kUnknownSize);
+  size_t pos = UpperBound(addr);
+  if ((pos == 0) || !IsEntryContains(pos - 1, addr)) {
+    return false;
+  }
+  *type = types_[pos - 1];
+  *size = sizes_[pos - 1];
+  return true;
+}
+
+size_t FrozenRangeMap::TryGetEntries(Span<const size_type> addrs,
+                                     Span<range_type> types,
+                                     Span<size_type> sizes,
+                                     Span<uint64_t> found) const {
+  CHECK(types.size() >= addrs.size());
+  CHECK(sizes.size() >= addrs.size());
+  CHECK(found.size() >= BitmaskWords(addrs.size()));
+  std::fill(found.begin(), found.begin() + BitmaskWords(addrs.size()), 0);
+
+  size_t found_count = 0;
+  auto report = [&](size_t i, size_t pos) {
+    types[i] = types_[pos];
+    sizes[i] = sizes_[pos];
+    SetBit(found, i);
+    ++found_count;
+  };
+
+  if (std::is_sorted(addrs.begin(), addrs.end())) {
+    // Merge-like sweep, next address can only hit the same or later entry.
+    // Jump with the index when the next address is far away.
+    size_t pos = 0;
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      size_type addr = addrs[i];
+      CHECK(addr != kUnknownSize);
+      size_t step = 0;
+      while (!IsEnd(pos) && GetEnd(pos) <= addr) {
+        if (++step > kMaxSweepSteps) {
+          pos = GetContainingOrNext(addr);
+          break;
+        }
+        ++pos;
+      }
+      if (!IsEnd(pos) && IsEntryContains(pos, addr)) {
+        report(i, pos);
+      }
+    }
+    return found_count;
+  }
+
+  size_t result[kGroupSize];
+  for (size_t first = 0; first < addrs.size(); first += kGroupSize) {
+    size_t count = std::min(kGroupSize, addrs.size() - first);
+    UpperBoundGroup(addrs.data() + first, count, result);
+    for (size_t i = 0; i < count; ++i) {
+      size_t pos = result[i];
+      CHECK(addrs[first + i] != kUnknownSize);
+      if ((pos != 0) && IsEntryContains(pos - 1, addrs[first + i])) {
+        report(first + i, pos - 1);
+      }
+    }
+  }
+  return found_count;
+}
+
+bool FrozenRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(size != kUnknownSize);
+  if (size == 0) {
+    return true;
+  }
+  CHECK(addr + size > addr);
+  size_t pos = GetContainingOrNext(addr);
+  size_type cov_end = addr + size;
+  while (cov_end > addr) {
+    if (IsEnd(pos) || !IsEntryContains(pos, addr)) {
+      return false;
+    }
+    if (sizes_[pos] == kUnknownSize) {
+      return true;
+    }
+    addr = GetEnd(pos);
+    ++pos;
+  }
+  return true;
+}
+
+size_t FrozenRangeMap::MemoryUsage() const {
+  size_t usage = sizeof(*this);
+  for (const auto &level : levels_) {
+    usage += level.capacity() * sizeof(Node);
+  }
+  usage += levels_.capacity() * sizeof(levels_[0]);
+  usage += types_.capacity() * sizeof(range_type);
+  usage += sizes_.capacity() * sizeof(size_type);
+  return usage;
+}
+
+}  // namespace rangemap
@@ -0,0 +1,283 @@
+#include "loader.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rangemap {
+
+const uint32_t ProcMapsParser::kRead;
+const uint32_t ProcMapsParser::kWrite;
+const uint32_t ProcMapsParser::kExec;
+const uint32_t ProcMapsParser::kShared;
+const size_t ProcMapsParser::kChunkSize;
+
+namespace {
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+const unsigned char kHostData = ELFDATA2LSB;
+#else
+const unsigned char kHostData = ELFDATA2MSB;
+#endif
+
+// count entries of entry_size bytes at offset are inside the file
+bool IsTableInside(uint64_t offset, uint64_t count, uint64_t entry_size,
+                   size_t data_size) {
+  if (offset > data_size) {
+    return false;
+  }
+  return count == 0 || (data_size - offset) / count >= entry_size;
+}
+
+// [base + addr, base + addr + size) fits the address space and has a fixed
+// size, a crafted header may point anywhere
+bool IsRangeInside(uint64_t base, uint64_t addr, uint64_t size) {
+  uint64_t begin = base + addr;
+  return begin >= base && size < RangeMap::kUnknownSize &&
+         size <= RangeMap::kUnknownSize - begin;
+}
+
+// Headers may be unaligned in a broken file, copy them out
+template <class T>
+T Load(const char *ptr) {
+  T value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+std::unique_ptr<ElfFile> ElfFile::Open(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < EI_NIDENT) {
+    close(fd);
+    return nullptr;
+  }
+  size_t data_size = st.st_size;
+  // Only headers are read, pages of the code are never touched
+  void *data = mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<ElfFile> file(new ElfFile(data, data_size));
+
+  const unsigned char *ident = static_cast<const unsigned char *>(data);
+  if (std::memcmp(ident, ELFMAG, SELFMAG) != 0 ||
+      ident[EI_DATA] != kHostData) {
+    return nullptr;
+  }
+  bool is_ok = false;
+  if (ident[EI_CLASS] == ELFCLASS64) {
+    is_ok = file->Parse<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr>();
+  } else if (ident[EI_CLASS] == ELFCLASS32) {
+    is_ok = file->Parse<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr>();
+  }
+  if (!is_ok) {
+    return nullptr;
+  }
+  return file;
+}
+
+ElfFile::ElfFile(void *data, size_t data_size)
+    : data_(data), data_size_(data_size), is_64_(false),
+      is_relocatable_(false), segments_(nullptr), segment_count_(0),
+      segment_entry_size_(0), sections_(nullptr), section_count_(0),
+      section_entry_size_(0), names_(nullptr), names_size_(0) {}
+
+ElfFile::~ElfFile() { munmap(data_, data_size_); }
+
+template <class Ehdr, class Phdr, class Shdr>
+bool ElfFile::Parse() {
+  const char *base = static_cast<const char *>(data_);
+  if (data_size_ < sizeof(Ehdr)) {
+    return false;
+  }
+  Ehdr header = Load<Ehdr>(base);
+  is_64_ = sizeof(Ehdr) == sizeof(Elf64_Ehdr);
+  is_relocatable_ = header.e_type == ET_DYN;
+
+  if (header.e_phnum != 0) {
+    if (header.e_phentsize < sizeof(Phdr) ||
+        !IsTableInside(header.e_phoff, header.e_phnum, header.e_phentsize,
+                       data_size_)) {
+      return false;
+    }
+    segments_ = base + header.e_phoff;
+    segment_count_ = header.e_phnum;
+    segment_entry_size_ = header.e_phentsize;
+  }
+
+  // Section headers are optional, stripped files may have none
+  if (header.e_shnum != 0) {
+    if (header.e_shentsize < sizeof(Shdr) ||
+        !IsTableInside(header.e_shoff, header.e_shnum, header.e_shentsize,
+                       data_size_)) {
+      return false;
+    }
+    sections_ = base + header.e_shoff;
+    section_count_ = header.e_shnum;
+    section_entry_size_ = header.e_shentsize;
+    if (header.e_shstrndx != SHN_UNDEF && header.e_shstrndx < section_count_) {
+      Shdr names = Load<Shdr>(sections_ +
+                              header.e_shstrndx * section_entry_size_);
+      if (names.sh_type != SHT_NOBITS &&
+          IsTableInside(names.sh_offset, 1, names.sh_size, data_size_)) {
+        names_ = base + names.sh_offset;
+        names_size_ = names.sh_size;
+      }
+    }
+  }
+  return true;
+}
+
+template <class Phdr>
+ElfFile::Segment ElfFile::ReadSegment(size_t i) const {
+  Phdr phdr = Load<Phdr>(segments_ + i * segment_entry_size_);
+  return {phdr.p_type, phdr.p_flags, phdr.p_offset, phdr.p_vaddr,
+          phdr.p_memsz};
+}
+
+template <class Shdr>
+ElfFile::Section ElfFile::ReadSection(size_t i) const {
+  Shdr shdr = Load<Shdr>(sections_ + i * section_entry_size_);
+  std::string_view name;
+  if (shdr.sh_name < names_size_) {
+    const char *begin = names_ + shdr.sh_name;
+    name = std::string_view(begin, strnlen(begin, names_size_ - shdr.sh_name));
+  }
+  return {name, shdr.sh_type, shdr.sh_flags, shdr.sh_addr, shdr.sh_size};
+}
+
+ElfFile::Segment ElfFile::GetSegment(size_t i) const {
+  CHECK(i < segment_count_);
+  return is_64_ ? ReadSegment<Elf64_Phdr>(i) : ReadSegment<Elf32_Phdr>(i);
+}
+
+ElfFile::Section ElfFile::GetSection(size_t i) const {
+  CHECK(i < section_count_);
+  return is_64_ ? ReadSection<Elf64_Shdr>(i) : ReadSection<Elf32_Shdr>(i);
+}
+
+void ElfFile::AppendSegments(range_type type, size_type base,
+                             std::vector<RangeMap::RangeSpec> *specs) const {
+  for (size_t i = 0; i < segment_count_; ++i) {
+    Segment segment = GetSegment(i);
+    if (segment.type == PT_LOAD && segment.size != 0 &&
+        IsRangeInside(GetBase(base), segment.vaddr, segment.size)) {
+      specs->push_back({type, GetBase(base) + segment.vaddr, segment.size});
+    }
+  }
+}
+
+void ElfFile::AppendSections(range_type first_type, size_type base,
+                             std::vector<RangeMap::RangeSpec> *specs) const {
+  for (size_t i = 0; i < section_count_; ++i) {
+    Section section = GetSection(i);
+    if ((section.flags & SHF_ALLOC) && section.size != 0 &&
+        IsRangeInside(GetBase(base), section.addr, section.size)) {
+      specs->push_back(
+          {first_type + i, GetBase(base) + section.addr, section.size});
+    }
+  }
+}
+
+namespace {
+
+// Parsers move pos past what they read and return false on a bad field
+
+bool ParseHex(std::string_view line, size_t *pos, uint64_t *value) {
+  size_t begin = *pos;
+  uint64_t result = 0;
+  for (; *pos < line.size(); ++*pos) {
+    char c = line[*pos];
+    unsigned digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      break;
+    }
+    if (result >> 60) {
+      return false;
+    }
+    result = (result << 4) | digit;
+  }
+  *value = result;
+  return *pos != begin;
+}
+
+bool ParseDec(std::string_view line, size_t *pos, uint64_t *value) {
+  size_t begin = *pos;
+  uint64_t result = 0;
+  for (; *pos < line.size() && line[*pos] >= '0' && line[*pos] <= '9';
+       ++*pos) {
+    uint64_t next = result * 10 + (line[*pos] - '0');
+    if (next / 10 != result) {
+      return false;
+    }
+    result = next;
+  }
+  *value = result;
+  return *pos != begin;
+}
+
+bool ParseChar(std::string_view line, size_t *pos, char c) {
+  if (*pos < line.size() && line[*pos] == c) {
+    ++*pos;
+    return true;
+  }
+  return false;
+}
+
+void SkipSpaces(std::string_view line, size_t *pos) {
+  while (*pos < line.size() && line[*pos] == ' ') {
+    ++*pos;
+  }
+}
+
+}  // namespace
+
+bool ProcMapsParser::ParseMapping(std::string_view line, bool *is_empty,
+                                  Mapping *mapping) {
+  // begin-end perms offset major:minor inode [path]
+  size_t pos = 0;
+  SkipSpaces(line, &pos);
+  *is_empty = (pos == line.size());
+  if (*is_empty) {
+    return true;
+  }
+  uint64_t major, minor;
+  if (!ParseHex(line, &pos, &mapping->begin) || !ParseChar(line, &pos, '-') ||
+      !ParseHex(line, &pos, &mapping->end) || !ParseChar(line, &pos, ' ') ||
+      mapping->end < mapping->begin || line.size() - pos < 4) {
+    return false;
+  }
+  const char *perms = line.data() + pos;
+  mapping->perms = ((perms[0] == 'r') ? kRead : 0) |
+                   ((perms[1] == 'w') ? kWrite : 0) |
+                   ((perms[2] == 'x') ? kExec : 0) |
+                   ((perms[3] == 's') ? kShared : 0);
+  pos += 4;
+  if (!ParseChar(line, &pos, ' ') ||
+      !ParseHex(line, &pos, &mapping->offset) || !ParseChar(line, &pos, ' ') ||
+      !ParseHex(line, &pos, &major) || !ParseChar(line, &pos, ':') ||
+      !ParseHex(line, &pos, &minor) || !ParseChar(line, &pos, ' ') ||
+      !ParseDec(line, &pos, &mapping->inode)) {
+    return false;
+  }
+  // Path is the rest of the line and may have spaces
+  SkipSpaces(line, &pos);
+  mapping->path = line.substr(pos);
+  return true;
+}
+
+}  // namespace rangemap
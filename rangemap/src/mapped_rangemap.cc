@@ -0,0 +1,130 @@
+#include "mapped_rangemap.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include "snapshot_format.h"
+
+namespace rangemap {
+
+const MappedRangeMap::size_type MappedRangeMap::kUnknownSize;
+
+namespace {
+
+// Sections are inside the file and hold count words
+bool IsValidHeader(const snapshot::Header &header, uint64_t file_size) {
+  if (std::memcmp(header.magic, snapshot::kMagic, sizeof(header.magic)) ||
+      header.version != snapshot::kVersion ||
+      header.byte_order != snapshot::kByteOrder ||
+      header.header_checksum != snapshot::HeaderChecksum(header) ||
+      header.file_size != file_size) {
+    return false;
+  }
+  if (header.count > file_size / sizeof(uint64_t)) {
+    return false;
+  }
+  uint64_t section_size =
+      snapshot::AlignToPage(header.count * sizeof(uint64_t));
+  return header.begins_offset == snapshot::kPageSize &&
+         header.types_offset == header.begins_offset + section_size &&
+         header.sizes_offset == header.types_offset + section_size &&
+         header.sizes_offset + section_size == file_size;
+}
+
+}  // namespace
+
+std::unique_ptr<MappedRangeMap> MappedRangeMap::Open(const std::string &path,
+                                                     bool is_verify) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < snapshot::kPageSize) {
+    close(fd);
+    return nullptr;
+  }
+  size_t data_size = st.st_size;
+  // Shared read-only mapping, pages come from the page cache
+  void *data = mmap(nullptr, data_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<MappedRangeMap> map(new MappedRangeMap(data, data_size));
+
+  const auto &header = *static_cast<const snapshot::Header *>(data);
+  if (!IsValidHeader(header, data_size)) {
+    return nullptr;
+  }
+  if (is_verify) {
+    snapshot::Checksum checksum;
+    checksum.Update(static_cast<const char *>(data) + header.begins_offset,
+                    header.file_size - header.begins_offset);
+    if (checksum.Get() != header.payload_checksum) {
+      return nullptr;
+    }
+  }
+
+  const char *base = static_cast<const char *>(data);
+  map->begins_ =
+      reinterpret_cast<const size_type *>(base + header.begins_offset);
+  map->types_ = reinterpret_cast<const uint64_t *>(base + header.types_offset);
+  map->sizes_ =
+      reinterpret_cast<const size_type *>(base + header.sizes_offset);
+  map->count_ = header.count;
+  map->is_continious_ = (header.flags & snapshot::kFlagContinious) != 0;
+  // Lookups are random
+  madvise(data, data_size, MADV_RANDOM);
+  return map;
+}
+
+MappedRangeMap::MappedRangeMap(void *data, size_t data_size)
+    : data_(data), data_size_(data_size), begins_(nullptr), types_(nullptr),
+      sizes_(nullptr), count_(0), is_continious_(true) {}
+
+MappedRangeMap::~MappedRangeMap() { munmap(data_, data_size_); }
+
+size_t MappedRangeMap::GetContainingOrNext(size_type addr) const {
+  size_t pos = UpperBound(begins_, count_, addr);
+  if ((pos != 0) && IsEntryContains(pos - 1, addr)) {
+    return pos - 1;
+  }
+  return pos;
+}
+
+bool MappedRangeMap::TryGetEntry(size_type addr, range_type *type,
+                                 size_type *size) const {
+  CHECK(addr != kUnknownSize);
+  size_t pos = UpperBound(begins_, count_, addr);
+  if ((pos == 0) || !IsEntryContains(pos - 1, addr)) {
+    return false;
+  }
+  *type = types_[pos - 1];
+  *size = sizes_[pos - 1];
+  return true;
+}
+
+bool MappedRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(size != kUnknownSize);
+  if (size == 0) {
+    return true;
+  }
+  CHECK(addr + size > addr);
+  size_t pos = GetContainingOrNext(addr);
+  size_type cov_end = addr + size;
+  while (cov_end > addr) {
+    if (IsEnd(pos) || !IsEntryContains(pos, addr)) {
+      return false;
+    }
+    if (sizes_[pos] == kUnknownSize) {
+      return true;
+    }
+    addr = GetEnd(pos);
+    ++pos;
+  }
+  return true;
+}
+
+}  // namespace rangemap
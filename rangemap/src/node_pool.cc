@@ -0,0 +1,84 @@
+#include "node_pool.h"
+#include <algorithm>
+
+namespace rangemap {
+
+const size_t NodePool::kAlignment;
+const size_t NodePool::kMinChunkBlocks;
+
+NodePool::NodePool(size_t block_size, std::pmr::memory_resource *upstream)
+    : block_size_(block_size), upstream_(upstream), is_active_(false),
+      free_list_(nullptr), free_count_(0), block_count_(0) {
+  CHECK(upstream_ != nullptr);
+  // Every block should be able to hold a free list link and keep alignment
+  block_size_ = std::max(block_size_, sizeof(FreeBlock));
+  block_size_ = (block_size_ + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+NodePool::~NodePool() {
+  for (const Chunk &chunk : chunks_) {
+    upstream_->deallocate(chunk.data, chunk.size, kAlignment);
+  }
+}
+
+void *NodePool::Allocate(size_t bytes, size_t alignment) {
+  if (!IsPooled(bytes, alignment)) {
+    return upstream_->allocate(bytes, alignment);
+  }
+  if (free_list_ == nullptr) {
+    Grow(std::max(kMinChunkBlocks, block_count_ / 2));
+  }
+  FreeBlock *block = free_list_;
+  free_list_ = block->next;
+  --free_count_;
+  return block;
+}
+
+void NodePool::Deallocate(void *ptr, size_t bytes, size_t alignment) {
+  // Blocks from before Reserve() still belong to upstream
+  if (!IsPooled(bytes, alignment) || !IsOwned(ptr)) {
+    upstream_->deallocate(ptr, bytes, alignment);
+    return;
+  }
+  FreeBlock *block = static_cast<FreeBlock *>(ptr);
+  block->next = free_list_;
+  free_list_ = block;
+  ++free_count_;
+}
+
+void NodePool::Reserve(size_t count) {
+  is_active_ = true;
+  if (count > free_count_) {
+    Grow(count - free_count_);
+  }
+}
+
+bool NodePool::IsOwned(const void *ptr) const {
+  // Chunks grow geometrically, so there are only a few of them
+  const char *p = static_cast<const char *>(ptr);
+  for (const Chunk &chunk : chunks_) {
+    if (p >= chunk.data && p < chunk.data + chunk.size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void NodePool::Grow(size_t count) {
+  CHECK(count != 0);
+  Chunk chunk;
+  chunk.size = count * block_size_;
+  chunk.data = static_cast<char *>(upstream_->allocate(chunk.size, kAlignment));
+  chunks_.push_back(chunk);
+  // Link in reverse, so blocks are taken in address order
+  for (size_t i = count; i-- > 0;) {
+    FreeBlock *block =
+        reinterpret_cast<FreeBlock *>(chunk.data + i * block_size_);
+    block->next = free_list_;
+    free_list_ = block;
+  }
+  free_count_ += count;
+  block_count_ += count;
+}
+
+}  // namespace rangemap
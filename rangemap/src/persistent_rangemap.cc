@@ -0,0 +1,168 @@
+#include "persistent_rangemap.h"
+
+namespace rangemap {
+
+const PersistentRangeMap::size_type PersistentRangeMap::kUnknownSize;
+
+PersistentRangeMap::PersistentRangeMap()
+    : count_(0), seed_(0x9e3779b97f4a7c15ULL) {}
+
+PersistentRangeMap::PersistentRangeMap(const PersistentRangeMap &other)
+    : root_(other.root_), count_(other.count_), seed_(other.seed_) {}
+
+PersistentRangeMap &
+PersistentRangeMap::operator=(const PersistentRangeMap &other) {
+  root_ = other.root_;
+  count_ = other.count_;
+  seed_ = other.seed_;
+  return *this;
+}
+
+void PersistentRangeMap::AddRange(range_type type, size_type addr,
+                                  size_type size) {
+  if (size == 0) {
+    return;
+  }
+  CHECK(addr != kUnknownSize);
+  // RangeMap looks at the entry before or at addr, entries that begin in
+  // the range and the first entry after them, nothing else can change
+  const Node *prev = FindLastNotAfter(addr);
+  size_type lo = (prev != nullptr) ? prev->begin : addr;
+  size_type hi = (size == kUnknownSize) ? addr + 1 : addr + size;
+  CHECK(hi > addr);
+
+  NodePtr before, rest, window, tail, next, after;
+  Split(root_, lo, &before, &rest);
+  Split(rest, hi, &window, &tail);
+  if (tail) {
+    const Node *first = tail.get();
+    while (first->left) {
+      first = first->left.get();
+    }
+    Split(tail, first->begin + 1, &next, &after);
+    window = Merge(window, next);
+  }
+
+  // Replay the window with RangeMap rules
+  scratch_.RemoveRange(0, kUnknownSize);
+  size_t window_count = 0;
+  auto replay = [&](size_type begin, size_type entry_size,
+                    range_type entry_type) {
+    scratch_.AddRange(entry_type, begin, entry_size);
+    ++window_count;
+  };
+  ForEach(window.get(), replay);
+  scratch_.AddRange(type, addr, size);
+
+  // Entries go in key order, appending keeps the treap valid
+  NodePtr updated;
+  size_t updated_count = 0;
+  for (auto entry : scratch_) {
+    size_type entry_size = (entry.end == kUnknownSize)
+                               ? kUnknownSize
+                               : entry.end - entry.begin;
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 7;
+    seed_ ^= seed_ << 17;
+    updated = Merge(updated, NewNode(entry.begin, entry_size, entry.type,
+                                     uint32_t(seed_), nullptr, nullptr));
+    ++updated_count;
+  }
+  root_ = Merge(Merge(before, updated), after);
+  count_ = count_ - window_count + updated_count;
+}
+
+bool PersistentRangeMap::TryGetEntry(size_type addr, range_type *type,
+                                     size_type *size) const {
+  CHECK(addr != kUnknownSize);
+  const Node *node = FindLastNotAfter(addr);
+  if (node == nullptr || GetEnd(*node) <= addr) {
+    return false;
+  }
+  *type = node->type;
+  *size = node->size;
+  return true;
+}
+
+bool PersistentRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(size != kUnknownSize);
+  if (size == 0) {
+    return true;
+  }
+  size_type end = ClipEnd(addr, size);
+  while (addr < end) {
+    const Node *node = FindLastNotAfter(addr);
+    if (node == nullptr || GetEnd(*node) <= addr) {
+      return false;
+    }
+    addr = GetEnd(*node);
+  }
+  return true;
+}
+
+PersistentRangeMap::NodePtr
+PersistentRangeMap::NewNode(size_type begin, size_type size, range_type type,
+                            uint32_t priority, NodePtr left,
+                            NodePtr right) const {
+  return std::make_shared<const Node>(
+      Node{begin, size, type, priority, std::move(left), std::move(right)});
+}
+
+PersistentRangeMap::NodePtr PersistentRangeMap::CopyWith(const Node &node,
+                                                         NodePtr left,
+                                                         NodePtr right) const {
+  return NewNode(node.begin, node.size, node.type, node.priority,
+                 std::move(left), std::move(right));
+}
+
+void PersistentRangeMap::Split(const NodePtr &node, size_type key, NodePtr *l,
+                               NodePtr *r) const {
+  if (!node) {
+    l->reset();
+    r->reset();
+    return;
+  }
+  if (node->begin < key) {
+    NodePtr right_l, right_r;
+    Split(node->right, key, &right_l, &right_r);
+    *l = (right_l == node->right) ? node
+                                  : CopyWith(*node, node->left, right_l);
+    *r = std::move(right_r);
+  } else {
+    NodePtr left_l, left_r;
+    Split(node->left, key, &left_l, &left_r);
+    *r = (left_r == node->left) ? node : CopyWith(*node, left_r, node->right);
+    *l = std::move(left_l);
+  }
+}
+
+PersistentRangeMap::NodePtr PersistentRangeMap::Merge(const NodePtr &l,
+                                                      const NodePtr &r) const {
+  if (!l) {
+    return r;
+  }
+  if (!r) {
+    return l;
+  }
+  if (l->priority > r->priority) {
+    return CopyWith(*l, l->left, Merge(l->right, r));
+  }
+  return CopyWith(*r, Merge(l, r->left), r->right);
+}
+
+const PersistentRangeMap::Node *
+PersistentRangeMap::FindLastNotAfter(size_type addr) const {
+  const Node *found = nullptr;
+  const Node *node = root_.get();
+  while (node != nullptr) {
+    if (node->begin <= addr) {
+      found = node;
+      node = node->right.get();
+    } else {
+      node = node->left.get();
+    }
+  }
+  return found;
+}
+
+}  // namespace rangemap
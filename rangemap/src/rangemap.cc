@@ -1,11 +1,102 @@
 #include "rangemap.h"
+#include "frozen_rangemap.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "snapshot_format.h"
 
 namespace rangemap {
 
-void RangeMap::AddRange(range_type type, size_type addr, size_type size) {
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::BasicRangeMap()
+    : BasicRangeMap(std::pmr::new_delete_resource()) {}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::BasicRangeMap(
+    std::pmr::memory_resource *upstream)
+    : upstream_(upstream), pool_(new NodePool(kNodeSize, upstream)),
+      map_(PoolAllocator<Value>(pool_.get())), gaps_(upstream),
+      stats_(0, typename Stats::hasher(), typename Stats::key_equal(),
+             typename Stats::allocator_type(upstream)),
+      covered_bytes_(0), version_(0) {}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::BasicRangeMap(const BasicRangeMap &other)
+    : upstream_(other.upstream_),
+      pool_(new NodePool(kNodeSize, other.upstream_)),
+      map_(other.map_, PoolAllocator<Value>(pool_.get())), gaps_(other.gaps_),
+      stats_(other.stats_), covered_bytes_(other.covered_bytes_),
+      version_(0) {}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::BasicRangeMap(
+    BasicRangeMap &&other) noexcept
+    : upstream_(other.upstream_), pool_(std::move(other.pool_)),
+      map_(std::move(other.map_)), gaps_(std::move(other.gaps_)),
+      stats_(std::move(other.stats_)), covered_bytes_(other.covered_bytes_),
+      version_(0) {
+  // Keep moved-from map usable, its pool is made by the first insert
+  other.map_.clear();
+  other.gaps_.Clear();
+  other.stats_.clear();
+  other.covered_bytes_ = 0;
+  ++other.version_;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT> &
+BasicRangeMap<AddrT, SizeT, TypeT>::operator=(const BasicRangeMap &other) {
+  // Allocator is not propagated, entries are copied into own pool
+  if (!pool_) {
+    MakePool();
+  }
+  map_ = other.map_;
+  gaps_ = other.gaps_;
+  stats_ = other.stats_;
+  covered_bytes_ = other.covered_bytes_;
+  ++version_;
+  return *this;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT> &
+BasicRangeMap<AddrT, SizeT, TypeT>::operator=(
+    BasicRangeMap &&other) noexcept {
+  // Allocators are swapped with maps, so pools go along with their nodes
+  std::swap(upstream_, other.upstream_);
+  pool_.swap(other.pool_);
+  map_.swap(other.map_);
+  std::swap(gaps_, other.gaps_);
+  stats_.swap(other.stats_);
+  std::swap(covered_bytes_, other.covered_bytes_);
+  ++version_;
+  ++other.version_;
+  return *this;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::Reserve(size_t count) {
+  if (!pool_) {
+    MakePool();
+  }
+  if (count > map_.size()) {
+    pool_->Reserve(count - map_.size());
+  }
+  // There is a gap before every entry at most
+  gaps_.Reserve(count);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRange(range_type type,
+                                                  size_type addr,
+                                                  size_type size) {
+  RANGEMAP_STATS_TIMER(kAddRange);
   if (size == 0) {
     return;
   }
+  ++version_;
   if (IsUnknownSize(size)) {
     AddRangeUnknownSize(type, addr);
   } else {
@@ -13,24 +104,236 @@ void RangeMap::AddRange(range_type type, size_type addr, size_type size) {
   }
 }
 
-void RangeMap::AddRangeRel(range_type type, size_type addr, size_type size,
-                           size_type rel_addr) {
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRangeRel(range_type type,
+                                                     size_type addr,
+                                                     size_type size,
+                                                     size_type rel_addr) {
   CHECK(rel_addr != kNoRelative);
   // TODO: check overflow
   CHECK(rel_addr + addr >= addr);
   AddRange(type, addr + rel_addr, size);
 }
 
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRanges(Span<const RangeSpec> ranges,
+                                                   bool is_sorted) {
+  RANGEMAP_STATS_TIMER(kAddRanges);
+  ++version_;
+  // Ranges that end before the tail can't cut it or merge into it, the tail
+  // stays where it is while they are added
+  auto is_bulk = [this](const RangeSpec &spec) {
+    range_type tail_type;
+    size_type tail_begin;
+    if (IsUnknownSize(spec.size)) {
+      return false;
+    }
+    return !TryGetUnknownTail(&tail_type, &tail_begin) ||
+           (spec.addr < tail_begin && spec.size < tail_begin - spec.addr);
+  };
+  size_t first = 0;
+  while (first < ranges.size()) {
+    const RangeSpec &spec = ranges[first];
+    if (!is_bulk(spec)) {
+      // Result depends on the current tail, keep per-call order
+      AddRange(spec.type, spec.addr, spec.size);
+      ++first;
+      continue;
+    }
+    // Fixed size ranges can't make a new unknown tail, take all of them
+    size_t last = first;
+    while (last < ranges.size() && is_bulk(ranges[last])) {
+      ++last;
+    }
+    AddRangesFixedSize(ranges.data() + first, last - first, is_sorted);
+    first = last;
+  }
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRangesFixedSize(
+    const RangeSpec *ranges, size_t count, bool is_sorted) {
+  // Spec that goes first in input wins on overlap, remember the order
+  struct Item {
+    size_type beg;
+    size_type end;
+    range_type type;
+    size_t order;
+  };
+  std::vector<Item> items;
+  items.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    if (ranges[i].size == 0) {
+      continue;
+    }
+    CHECK(ranges[i].addr + ranges[i].size > ranges[i].addr);
+    items.push_back({ranges[i].addr, ranges[i].addr + ranges[i].size,
+                     ranges[i].type, i});
+  }
+  auto by_begin = [](const Item &a, const Item &b) { return a.beg < b.beg; };
+  if (is_sorted) {
+    CHECK(std::is_sorted(items.begin(), items.end(), by_begin));
+  } else {
+    std::stable_sort(items.begin(), items.end(), by_begin);
+  }
+
+  // Paint the new ranges: every point belongs to the first spec in input
+  // order. Active specs are kept in the heap ordered by input order, ended
+  // ones are dropped lazily. Neighbour pieces of the same type are joined.
+  std::vector<EntryView> pieces;
+  auto by_order = [](const Item &a, const Item &b) { return a.order > b.order; };
+  std::vector<Item> active;
+  size_t next = 0;
+  size_type cur = 0;
+  while (next < items.size() || !active.empty()) {
+    if (active.empty()) {
+      cur = std::max(cur, items[next].beg);
+    }
+    while (next < items.size() && items[next].beg <= cur) {
+      active.push_back(items[next++]);
+      std::push_heap(active.begin(), active.end(), by_order);
+    }
+    while (!active.empty() && active.front().end <= cur) {
+      std::pop_heap(active.begin(), active.end(), by_order);
+      active.pop_back();
+    }
+    if (active.empty()) {
+      continue;
+    }
+    const Item &owner = active.front();
+    size_type piece_end = owner.end;
+    if (next < items.size()) {
+      piece_end = std::min(piece_end, items[next].beg);
+    }
+    if (!pieces.empty() && pieces.back().end == cur &&
+        pieces.back().type == owner.type) {
+      pieces.back().end = piece_end;
+    } else {
+      pieces.push_back({cur, piece_end, owner.type});
+    }
+    cur = piece_end;
+  }
+
+  FillGaps(pieces.begin(), pieces.end());
+}
+
+template <class AddrT, class SizeT, class TypeT>
+template <class It>
+void BasicRangeMap<AddrT, SizeT, TypeT>::FillGaps(It first, It last) {
+  range_type tail_type;
+  size_type tail_begin = kUnknownSize;
+  TryGetUnknownTail(&tail_type, &tail_begin);
+  auto it = map_.end();
+  for (bool is_first = true; first != last; ++first, is_first = false) {
+    const EntryView piece = *first;
+    CHECK(!IsUnknownSize(piece.end));
+    // Pieces stay before the tail
+    CHECK(piece.end < tail_begin);
+    size_type beg = piece.begin;
+    it = is_first ? GetContainingOrNext(beg)
+                  : AdvanceToContainingOrNext(it, beg);
+    while (beg < piece.end) {
+      if (!IsEnd(it) && GetBegin(it) <= beg) {
+        // Existing entry goes first, keep it if next pieces may start in it
+        beg = GetEnd(it);
+        if (beg >= piece.end) {
+          break;
+        }
+        ++it;
+        continue;
+      }
+      size_type gap_end = piece.end;
+      if (!IsEnd(it)) {
+        gap_end = std::min(gap_end, GetBegin(it));
+      }
+      it = AddEntry(it, piece.type, beg, gap_end - beg);
+    }
+  }
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::Merge(
+    const BasicRangeMap &lower_priority) {
+  RANGEMAP_STATS_TIMER(kMerge);
+  if (this == &lower_priority || lower_priority.map_.empty()) {
+    return;
+  }
+  ++version_;
+  const_iterator first = lower_priority.begin();
+  const_iterator last = lower_priority.end();
+  if (lower_priority.HasUnknownTail()) {
+    --last;
+  }
+  if (HasUnknownTail()) {
+    // Ranges that meet the tail cut it, keep per-entry order
+    for (; first != last; ++first) {
+      AddRange((*first).type, (*first).begin, (*first).end - (*first).begin);
+    }
+  } else {
+    FillGaps(first, last);
+  }
+  if (last != lower_priority.end()) {
+    AddRange((*last).type, (*last).begin, kUnknownSize);
+  }
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::ParallelBuild(
+    Span<const Span<const RangeSpec>> sources, size_t threads) {
+  threads = std::max<size_t>(1, std::min(threads, sources.size()));
+  // Thread i takes sources [i * n / threads, (i + 1) * n / threads)
+  std::vector<BasicRangeMap> maps(threads);
+  auto build = [&](size_t i) {
+    size_t lo = i * sources.size() / threads;
+    size_t hi = (i + 1) * sources.size() / threads;
+    for (size_t j = lo; j < hi; ++j) {
+      maps[i].AddRanges(sources[j]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(build, i);
+  }
+  build(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  // Tree reduction, maps[i] takes maps[i + step] on every level
+  for (size_t step = 1; step < threads; step *= 2) {
+    workers.clear();
+    for (size_t i = step * 2; i + step < threads; i += step * 2) {
+      workers.emplace_back([&maps, i, step]() {
+        maps[i].Merge(maps[i + step]);
+        maps[i + step] = BasicRangeMap();
+      });
+    }
+    maps[0].Merge(maps[step]);
+    maps[step] = BasicRangeMap();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+  return std::move(maps[0]);
+}
+
+template <class AddrT, class SizeT, class TypeT>
 template <class T>
-bool RangeMap::MaybeMergeEntry(T it, size_type type, size_type addr,
-                               size_type size) {
+bool BasicRangeMap<AddrT, SizeT, TypeT>::MaybeMergeEntry(T it, size_type type,
+                                                         size_type addr,
+                                                         size_type size,
+                                                         T *merged) {
   bool is_merged = false;
 
   if (!IsEnd(it)) {
     // Merge into next entry
-    if ((type == GetType(it)) && (GetBegin(it) == addr + size)) {
+    if ((type == GetType(it)) && !IsUnknownSize(size) &&
+        (GetBegin(it) == addr + size)) {
+      RANGEMAP_STATS_COUNT(kMergeNext, 1);
       AddSize(it, size);
       SetEntryAddress(it, addr);
+      *merged = it;
       is_merged = true;
     }
   }
@@ -40,10 +343,14 @@ bool RangeMap::MaybeMergeEntry(T it, size_type type, size_type addr,
     auto prev = std::prev(it);
     if ((type == GetType(prev)) && (GetEnd(prev) == addr)) {
       // Maybe collapse with the next region
+      RANGEMAP_STATS_COUNT(kMergePrev, 1);
       AddSize(prev, is_merged ? GetSize(it) : size);
       if (is_merged) {
+        RANGEMAP_STATS_COUNT(kMergeBoth, 1);
+        UncountEntry(GetType(it), GetSize(it));
         map_.erase(it);
       }
+      *merged = prev;
       is_merged = true;
     }
   }
@@ -51,9 +358,11 @@ bool RangeMap::MaybeMergeEntry(T it, size_type type, size_type addr,
   return is_merged;
 }
 
+template <class AddrT, class SizeT, class TypeT>
 template <class T>
-void RangeMap::AddEntry(T it, size_type type, size_type addr, size_type size) {
-  if (size == 0) return;
+T BasicRangeMap<AddrT, SizeT, TypeT>::AddEntry(T it, size_type type,
+                                               size_type addr, size_type size) {
+  if (size == 0) return it;
 
   if (!IsUnknownSize(size)) {
     CHECK(addr + size >= addr);
@@ -63,11 +372,23 @@ void RangeMap::AddEntry(T it, size_type type, size_type addr, size_type size) {
     CHECK(GetBegin(it) > addr);
   }
 
-  if (!MaybeMergeEntry(it, type, addr, size))
-    map_.emplace_hint(it, addr, Entry(type, size));
+  if (!pool_) {
+    // Map is empty, 'it' is the end of the old tree
+    MakePool();
+    it = map_.end();
+  }
+  CoverGap(addr, size);
+  T merged;
+  if (MaybeMergeEntry(it, type, addr, size, &merged)) {
+    return merged;
+  }
+  CountEntry(type, size);
+  return map_.emplace_hint(it, addr, Entry(type, size));
 }
 
-void RangeMap::AddRangeUnknownSize(size_type type, size_type addr) {
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRangeUnknownSize(size_type type,
+                                                             size_type addr) {
   // Can spawn only 1 range, maybe fix prev entry size
   auto it = GetContainingOrNext(addr);
   size_type base_beg = addr;
@@ -100,8 +421,10 @@ void RangeMap::AddRangeUnknownSize(size_type type, size_type addr) {
   AddEntry(it, type, base_beg, base_size);
 }
 
-void RangeMap::AddRangeFixedSize(size_type type, size_type addr,
-                                 size_type size) {
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AddRangeFixedSize(size_type type,
+                                                           size_type addr,
+                                                           size_type size) {
   CHECK(!IsUnknownSize(size));
   auto it = GetContainingOrNext(addr);
 
@@ -109,6 +432,7 @@ void RangeMap::AddRangeFixedSize(size_type type, size_type addr,
   size_type base_end = addr + size;
   CHECK(base_end > base_beg);
   while (true) {
+    RANGEMAP_STATS_COUNT(kFixedSizeStep, 1);
     // TODO: sanity check for overflow?
     if (IsEnd(it)) {
       AddEntry(it, type, base_beg, base_end - base_beg);
@@ -117,14 +441,24 @@ void RangeMap::AddRangeFixedSize(size_type type, size_type addr,
       VerifyEntry(it);
       if (IsEntryContains(it, base_beg)) {
         if (IsUnknownSize(GetEnd(it))) {
-          it->second.size = base_end - base_beg;
+          if (GetBegin(it) == base_beg) {
+            // Unknown entry takes the whole rest of the range
+            SetEntrySize(it, base_end - base_beg);
+            gaps_.Uncover(base_end, kUnknownSize);
+            base_beg = base_end;
+          } else {
+            // Cut unknown entry, the rest will be added after it
+            SetEntrySize(it, base_beg - GetBegin(it));
+            gaps_.Uncover(base_beg, kUnknownSize);
+          }
         } else {
           base_beg = GetEnd(it);
         }
       } else {
         size_type next_beg = GetBegin(it);
         if (base_end > next_beg) {
-          AddEntry(it, type, base_beg, next_beg - base_beg);
+          // 'it' may be merged away, continue from the covering entry
+          it = AddEntry(it, type, base_beg, next_beg - base_beg);
           base_beg = GetEnd(it);
         } else {
           AddEntry(it, type, base_beg, base_end - base_beg);
@@ -140,8 +474,144 @@ void RangeMap::AddRangeFixedSize(size_type type, size_type addr,
   }
 }
 
-bool RangeMap::TryGetEntry(size_type addr, range_type *type,
-                           size_type *size) const {
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::TryAddRangeStrict(
+    range_type type, size_type addr, size_type size, EntryView *conflict) {
+  RANGEMAP_STATS_TIMER(kTryAddRangeStrict);
+  if (size == 0) {
+    return true;
+  }
+  if (!IsUnknownSize(size) && size_type(addr + size) < addr) {
+    return false;
+  }
+  size_type end = IsUnknownSize(size) ? kUnknownSize : addr + size;
+  // Only the entry before addr and the next one may overlap
+  auto next = map_.upper_bound(addr);
+  if (!IsBegin(next)) {
+    auto prev = std::prev(next);
+    if (GetEnd(prev) > addr) {
+      if (conflict != nullptr) {
+        *conflict = *const_iterator(prev);
+      }
+      return false;
+    }
+  }
+  if (!IsEnd(next) && GetBegin(next) < end) {
+    if (conflict != nullptr) {
+      *conflict = *const_iterator(next);
+    }
+    return false;
+  }
+  ++version_;
+  AddEntry(next, type, addr, size);
+  return true;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::RemoveRange(size_type addr,
+                                                     size_type size) {
+  RANGEMAP_STATS_TIMER(kRemoveRange);
+  if (size == 0) {
+    return;
+  }
+  size_type end = IsUnknownSize(size) ? kUnknownSize : ClipEnd(addr, size);
+  ++version_;
+  EraseRange(addr, end);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+void BasicRangeMap<AddrT, SizeT, TypeT>::AssignRange(range_type type,
+                                                     size_type addr,
+                                                     size_type size) {
+  RANGEMAP_STATS_TIMER(kAssignRange);
+  if (size == 0) {
+    return;
+  }
+  size_type end = IsUnknownSize(size) ? kUnknownSize : addr + size;
+  CHECK(end > addr);
+  ++version_;
+  auto next = EraseRange(addr, end);
+  AddEntry(next, type, addr, size);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::EraseRange(size_type addr, size_type end) {
+  auto first = GetContainingOrNext(addr);
+  if (IsEnd(first) || GetBegin(first) >= end) {
+    return first;
+  }
+  gaps_.Uncover(addr, end);
+  if (GetBegin(first) < addr) {
+    size_type first_end = GetEnd(first);
+    SetEntrySize(first, addr - GetBegin(first));
+    if (first_end > end) {
+      // Range is inside the entry, the rest goes after it
+      size_type rest =
+          IsUnknownSize(first_end) ? kUnknownSize : first_end - end;
+      CountEntry(GetType(first), rest);
+      return map_.emplace_hint(std::next(first), end,
+                               Entry(GetType(first), rest));
+    }
+    ++first;
+  }
+  auto last = first;
+  while (!IsEnd(last) && GetEnd(last) <= end) {
+    RANGEMAP_STATS_COUNT(kEraseEntry, 1);
+    UncountEntry(GetType(last), GetSize(last));
+    ++last;
+  }
+  last = map_.erase(first, last);
+  if (!IsEnd(last) && GetBegin(last) < end) {
+    // Entry goes after the range, keep its end
+    if (!IsUnknownSize(last)) {
+      SetEntrySize(last, GetEnd(last) - end);
+    }
+    auto next = std::next(last);
+    SetEntryAddress(last, end);
+    return std::prev(next);
+  }
+  return last;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::Intersect(const BasicRangeMap &a,
+                                              const BasicRangeMap &b) {
+  BasicRangeMap result;
+  Sweep(a, b, [&](size_type begin, size_type end, const range_type *a_type,
+                  const range_type *b_type) {
+    if (a_type != nullptr && b_type != nullptr) {
+      // Parts go in address order, append after the last entry
+      result.AddEntry(result.map_.end(), *a_type, begin,
+                      (end == kUnknownSize) ? kUnknownSize : end - begin);
+    }
+    return true;
+  });
+  return result;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::Subtract(const BasicRangeMap &a,
+                                             const BasicRangeMap &b) {
+  BasicRangeMap result;
+  Sweep(a, b, [&](size_type begin, size_type end, const range_type *a_type,
+                  const range_type *b_type) {
+    if (a_type != nullptr && b_type == nullptr) {
+      result.AddEntry(result.map_.end(), *a_type, begin,
+                      (end == kUnknownSize) ? kUnknownSize : end - begin);
+    }
+    return true;
+  });
+  return result;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::TryGetEntry(size_type addr,
+                                                     range_type *type,
+                                                     size_type *size) const {
+  RANGEMAP_STATS_TIMER(kTryGetEntry);
   CHECK(!IsUnknownSize(addr));
   auto it = GetContaining(addr);
   if (IsEnd(it)) {
@@ -155,30 +625,243 @@ bool RangeMap::TryGetEntry(size_type addr, range_type *type,
   }
 }
 
-bool RangeMap::IsRangeCovered(size_type addr, size_type size) const {
+template <class AddrT, class SizeT, class TypeT>
+size_t BasicRangeMap<AddrT, SizeT, TypeT>::TryGetEntries(
+    Span<const size_type> addrs, Span<range_type> types, Span<size_type> sizes,
+    Span<uint64_t> found) const {
+  RANGEMAP_STATS_TIMER(kTryGetEntries);
+  CHECK(types.size() >= addrs.size());
+  CHECK(sizes.size() >= addrs.size());
+  CHECK(found.size() >= BitmaskWords(addrs.size()));
+  std::fill(found.begin(), found.begin() + BitmaskWords(addrs.size()), 0);
+  if (addrs.empty()) {
+    return 0;
+  }
+
+  size_t found_count = 0;
+  if (std::is_sorted(addrs.begin(), addrs.end())) {
+    // Merge-like sweep, next address can only hit the same or later entry
+    auto it = GetContainingOrNext(addrs[0]);
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      CHECK(!IsUnknownSize(addrs[i]));
+      it = AdvanceToContainingOrNext(it, addrs[i]);
+      if (!IsEnd(it) && IsEntryContains(it, addrs[i])) {
+        types[i] = GetType(it);
+        sizes[i] = GetSize(it);
+        SetBit(found, i);
+        ++found_count;
+      }
+    }
+  } else {
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      if (TryGetEntry(addrs[i], &types[i], &sizes[i])) {
+        SetBit(found, i);
+        ++found_count;
+      }
+    }
+  }
+  return found_count;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+IteratorRange<typename BasicRangeMap<AddrT, SizeT, TypeT>::const_iterator>
+BasicRangeMap<AddrT, SizeT, TypeT>::EntriesInRange(size_type addr,
+                                                   size_type size) const {
+  if (size == 0) {
+    return {end(), end()};
+  }
+  size_type end = IsUnknownSize(size) ? kUnknownSize : ClipEnd(addr, size);
+  // Entries before the first one end before addr, so last is not before it
+  return {const_iterator(GetContainingOrNext(addr)),
+          const_iterator(map_.lower_bound(end))};
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::IsRangeCovered(size_type addr,
+                                                        size_type size) const {
+  RANGEMAP_STATS_TIMER(kIsRangeCovered);
+  CHECK(!IsUnknownSize(size));
+  if (size == 0) {
+    return true;
+  }
+  size_type uncovered;
+  return !FindFirstUncovered(addr, size, &uncovered);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::FindFirstUncovered(
+    size_type addr, size_type size, size_type *uncovered) const {
+  RANGEMAP_STATS_TIMER(kFindFirstUncovered);
   CHECK(!IsUnknownSize(size));
+  if (size == 0) {
+    return false;
+  }
+  // First gap that ends after addr, the range is covered if it starts later
+  size_type gap_begin, gap_end;
+  if (!gaps_.FindContainingOrNext(addr, &gap_begin, &gap_end) ||
+      gap_begin >= ClipEnd(addr, size)) {
+    return false;
+  }
+  *uncovered = std::max(addr, gap_begin);
+  return true;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+BasicRangeMap<AddrT, SizeT, TypeT>::Cursor::Cursor(const BasicRangeMap &map)
+    : map_(&map), it_(map.map_.end()), version_(map.version_ - 1), hits_(0),
+      misses_(0) {}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::const_iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::Cursor::Seek(size_type addr) {
+  // Tree iterators can't jump, so galloping is the same as a short walk
+  if (version_ == map_->version_) {
+    auto it = it_;
+    if (!map_->IsEnd(it) && map_->GetBegin(it) <= addr) {
+      // Walk forward
+      for (size_t step = 0; step < kMaxSweepSteps; ++step) {
+        if (map_->IsEntryContains(it, addr)) {
+          ++hits_;
+          return it;
+        }
+        ++it;
+        if (map_->IsEnd(it) || map_->GetBegin(it) > addr) {
+          ++hits_;
+          return it;
+        }
+      }
+    } else {
+      // Walk backward
+      for (size_t step = 0; step < kMaxSweepSteps; ++step) {
+        if (map_->IsBegin(it)) {
+          ++hits_;
+          return it;
+        }
+        auto prev = std::prev(it);
+        if (map_->GetBegin(prev) <= addr) {
+          ++hits_;
+          return map_->IsEntryContains(prev, addr) ? prev : it;
+        }
+        it = prev;
+      }
+    }
+  }
+  ++misses_;
+  version_ = map_->version_;
+  return map_->GetContainingOrNext(addr);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::Cursor::TryGetEntry(size_type addr,
+                                                             range_type *type,
+                                                             size_type *size) {
+  RANGEMAP_STATS_TIMER(kCursorTryGetEntry);
+  CHECK(!map_->IsUnknownSize(addr));
+  it_ = Seek(addr);
+  if (map_->IsEnd(it_) || !map_->IsEntryContains(it_, addr)) {
+    return false;
+  }
+  *type = map_->GetType(it_);
+  *size = map_->GetSize(it_);
+  return true;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::Cursor::IsRangeCovered(
+    size_type addr, size_type size) {
+  RANGEMAP_STATS_TIMER(kCursorIsRangeCovered);
+  CHECK(!map_->IsUnknownSize(size));
   if (size == 0) {
     return true;
   }
-  // TODO: strict check overflow
-  CHECK(addr + size > addr);
-  auto it = GetContainingOrNext(addr);
-  size_type cov_end = addr + size;
-  while (cov_end > addr) {
-    if (IsEnd(it) || !IsEntryContains(it, addr)) {
+  it_ = Seek(addr);
+  size_type cov_end = ClipEnd(addr, size);
+  while (true) {
+    RANGEMAP_STATS_COUNT(kCursorCoverStep, 1);
+    if (map_->IsEnd(it_) || !map_->IsEntryContains(it_, addr)) {
       return false;
     }
-
-    if (IsUnknownSize(it)) {
+    if (map_->IsUnknownSize(it_)) {
       return true;
     }
-    addr = GetEnd(it);
-    ++it;
+    addr = map_->GetEnd(it_);
+    if (addr >= cov_end) {
+      return true;
+    }
+    ++it_;
+  }
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::IsContinious() const {
+  RANGEMAP_STATS_TIMER(kIsContinious);
+  bool is_continious = !HasUnknownTail() && GapCount() == 0;
+#ifdef RANGEMAP_EXPENSIVE_CHECKS
+  // O(n) walk over the entries
+  CHECK(is_continious == IsContiniousSlow());
+#endif
+  return is_continious;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+size_t BasicRangeMap<AddrT, SizeT, TypeT>::GapCount() const {
+  if (map_.empty()) {
+    return 0;
+  }
+  // Gap index also has the gaps before the first entry and after the last
+  size_t count = gaps_.Count();
+  if (GetBegin(map_.begin()) != 0) {
+    --count;
+  }
+  if (!IsUnknownSize(GetEnd(std::prev(map_.end())))) {
+    --count;
+  }
+  return count;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::size_type
+BasicRangeMap<AddrT, SizeT, TypeT>::GetSpan() const {
+  if (map_.empty()) {
+    return 0;
+  }
+  auto last = std::prev(map_.end());
+  if (IsUnknownSize(last)) {
+    return kUnknownSize;
   }
+  return GetEnd(last) - GetBegin(map_.begin());
+}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::size_type
+BasicRangeMap<AddrT, SizeT, TypeT>::CoveredBytes(range_type type) const {
+  auto it = stats_.find(type);
+  return (it == stats_.end()) ? 0 : it->second.bytes;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+size_t BasicRangeMap<AddrT, SizeT, TypeT>::EntryCount(range_type type) const {
+  auto it = stats_.find(type);
+  return (it == stats_.end()) ? 0 : it->second.entries;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::TryGetUnknownTail(
+    range_type *type, size_type *addr) const {
+  if (!HasUnknownTail()) {
+    return false;
+  }
+  auto last = std::prev(map_.end());
+  *type = GetType(last);
+  *addr = GetBegin(last);
   return true;
 }
 
-bool RangeMap::IsContinious() const {
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::IsContiniousSlow() const {
+  if (map_.empty()) {
+    return true;
+  }
   size_type prev_end = GetBegin(map_.begin());
   for (auto it = map_.begin(); it != map_.end(); ++it) {
     if (IsUnknownSize(it) || (GetBegin(it) != prev_end)) {
@@ -189,8 +872,43 @@ bool RangeMap::IsContinious() const {
   return true;
 }
 
-RangeMap::Map::const_iterator RangeMap::GetContainingOrNext(
-    size_type addr) const {
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::FindGapAtLeast(size_type min_size,
+                                                        size_type *addr,
+                                                        size_type *size,
+                                                        size_type hint) const {
+  RANGEMAP_STATS_TIMER(kFindGapAtLeast);
+  CHECK(min_size != 0);
+  size_type begin, end;
+  if (!gaps_.FindAtLeast(min_size, hint, &begin, &end)) {
+    return false;
+  }
+  *addr = begin;
+  *size = end - begin;
+  return true;
+}
+
+template <class AddrT, class SizeT, class TypeT>
+FrozenRangeMap BasicRangeMap<AddrT, SizeT, TypeT>::Freeze() const {
+  // Frozen map has 64-bit entries for any widths
+  std::vector<FrozenRangeMap::size_type> begins;
+  std::vector<FrozenRangeMap::range_type> types;
+  std::vector<FrozenRangeMap::size_type> sizes;
+  begins.reserve(map_.size());
+  types.reserve(map_.size());
+  sizes.reserve(map_.size());
+  for (auto it = map_.begin(); it != map_.end(); ++it) {
+    begins.push_back(GetBegin(it));
+    types.push_back(GetType(it));
+    sizes.push_back(IsUnknownSize(it) ? FrozenRangeMap::kUnknownSize
+                                      : GetSize(it));
+  }
+  return FrozenRangeMap(std::move(begins), std::move(types), std::move(sizes));
+}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::const_iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::GetContainingOrNext(size_type addr) const {
   // X      X      X    X       X    X        X      X    X       X
   //     A-------       B--------    C---------------D-------
   // A      A      B    B       C    C        C      D    D       -
@@ -218,7 +936,9 @@ RangeMap::Map::const_iterator RangeMap::GetContainingOrNext(
   }
 }
 
-RangeMap::Map::iterator RangeMap::GetContainingOrNext(size_type addr) {
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::GetContainingOrNext(size_type addr) {
   auto it = map_.upper_bound(addr);  // O(log N)
   if (!IsBegin(it)) {
     auto prev = std::prev(it);
@@ -232,7 +952,9 @@ RangeMap::Map::iterator RangeMap::GetContainingOrNext(size_type addr) {
   }
 }
 
-RangeMap::Map::const_iterator RangeMap::GetContaining(size_type addr) const {
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::const_iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::GetContaining(size_type addr) const {
   auto it = map_.upper_bound(addr);  // O(log N)
   // TODO: simplified
   if (IsBegin(it)) {
@@ -245,21 +967,53 @@ RangeMap::Map::const_iterator RangeMap::GetContaining(size_type addr) const {
   return it;
 }
 
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::const_iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::AdvanceToContainingOrNext(
+    typename Map::const_iterator it, size_type addr) const {
+  for (size_t step = 0; step < kMaxSweepSteps; ++step) {
+    if (IsEnd(it) || (GetEnd(it) > addr)) {
+      return it;
+    }
+    ++it;
+  }
+  return GetContainingOrNext(addr);
+}
+
+template <class AddrT, class SizeT, class TypeT>
+typename BasicRangeMap<AddrT, SizeT, TypeT>::Map::iterator
+BasicRangeMap<AddrT, SizeT, TypeT>::AdvanceToContainingOrNext(
+    typename Map::iterator it, size_type addr) {
+  for (size_t step = 0; step < kMaxSweepSteps; ++step) {
+    if (IsEnd(it) || (GetEnd(it) > addr)) {
+      return it;
+    }
+    ++it;
+  }
+  return GetContainingOrNext(addr);
+}
+
+template <class AddrT, class SizeT, class TypeT>
 template <class T>
-bool RangeMap::IsEntryContains(T it, size_type addr) const {
+bool BasicRangeMap<AddrT, SizeT, TypeT>::IsEntryContains(T it,
+                                                         size_type addr) const {
   return ((addr >= GetBegin(it)) && (GetEnd(it) > addr));
 }
 
+template <class AddrT, class SizeT, class TypeT>
 template <class T>
-void RangeMap::MaybeUpdateUnknownSize(T it, size_type next_addr) {
+void BasicRangeMap<AddrT, SizeT, TypeT>::MaybeUpdateUnknownSize(
+    T it, size_type next_addr) {
   CHECK(!IsUnknownSize(next_addr));
   if ((IsUnknownSize(it)) && (GetBegin(it) < next_addr)) {
-    it->second.size = next_addr - it->first;
+    SetEntrySize(it, next_addr - it->first);
+    gaps_.Uncover(next_addr, kUnknownSize);
   }
 }
 
+template <class AddrT, class SizeT, class TypeT>
 template <class T>
-void RangeMap::VerifyEntry(T it) const {
+void BasicRangeMap<AddrT, SizeT, TypeT>::VerifyEntry(T it) const {
   // TODO: strict check overflow
   if (!IsUnknownSize(it)) {
     CHECK(GetBegin(it) + GetSize(it) > GetBegin(it));
@@ -269,4 +1023,87 @@ void RangeMap::VerifyEntry(T it) const {
   CHECK(IsBegin(it) || GetEnd(std::prev(it)) <= GetBegin(it));
 }
 
+template <class AddrT, class SizeT, class TypeT>
+bool BasicRangeMap<AddrT, SizeT, TypeT>::SaveTo(const std::string &path) const {
+  RANGEMAP_STATS_TIMER(kSaveTo);
+  snapshot::Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, snapshot::kMagic, sizeof(header.magic));
+  header.version = snapshot::kVersion;
+  header.byte_order = snapshot::kByteOrder;
+  header.count = map_.size();
+  header.flags = IsContinious() ? snapshot::kFlagContinious : 0;
+  uint64_t section_size =
+      snapshot::AlignToPage(header.count * sizeof(uint64_t));
+  header.begins_offset = snapshot::kPageSize;
+  header.types_offset = header.begins_offset + section_size;
+  header.sizes_offset = header.types_offset + section_size;
+  header.file_size = header.sizes_offset + section_size;
+
+  // Write next to the target and rename, readers never see a partial file
+  std::string tmp_path = path + ".tmp";
+  std::FILE *file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool is_ok = true;
+  snapshot::Checksum checksum;
+  // Buffer one page, sections are written page by page
+  const size_t kPageWords = snapshot::kPageSize / sizeof(uint64_t);
+  std::vector<uint64_t> buffer;
+  buffer.reserve(kPageWords);
+  auto flush = [&](bool is_payload) {
+    size_t bytes = buffer.size() * sizeof(uint64_t);
+    if (is_payload) {
+      checksum.Update(buffer.data(), bytes);
+    }
+    is_ok = is_ok && (std::fwrite(buffer.data(), 1, bytes, file) == bytes);
+    buffer.clear();
+  };
+  // Zeros up to the next page
+  auto pad = [&]() {
+    while (buffer.size() % kPageWords != 0) {
+      buffer.push_back(0);
+    }
+    flush(true);
+  };
+  auto write_section = [&](uint64_t (*get)(typename Map::const_iterator)) {
+    for (auto it = map_.begin(); it != map_.end(); ++it) {
+      buffer.push_back(get(it));
+      if (buffer.size() == kPageWords) {
+        flush(true);
+      }
+    }
+    pad();
+  };
+
+  // Header goes last, when the checksum is known
+  buffer.assign(kPageWords, 0);
+  flush(false);
+  write_section(
+      [](typename Map::const_iterator it) -> uint64_t { return it->first; });
+  write_section([](typename Map::const_iterator it) -> uint64_t {
+    return it->second.type;
+  });
+  // Unknown size is the 64-bit one in the file
+  write_section([](typename Map::const_iterator it) -> uint64_t {
+    return (it->second.size == kUnknownSize)
+               ? std::numeric_limits<uint64_t>::max()
+               : it->second.size;
+  });
+  header.payload_checksum = checksum.Get();
+  header.header_checksum = snapshot::HeaderChecksum(header);
+  is_ok = is_ok && (std::fseek(file, 0, SEEK_SET) == 0) &&
+          (std::fwrite(&header, sizeof(header), 1, file) == 1);
+  is_ok = (std::fclose(file) == 0) && is_ok;
+  if (is_ok && std::rename(tmp_path.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  std::remove(tmp_path.c_str());
+  return false;
+}
+
+template class BasicRangeMap<uint64_t, uint64_t, size_t>;
+template class BasicRangeMap<uint32_t, uint32_t, uint8_t>;
+
 }  // namespace rangemap
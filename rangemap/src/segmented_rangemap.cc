@@ -0,0 +1,155 @@
+#include "segmented_rangemap.h"
+#include <algorithm>
+
+namespace rangemap {
+
+const SegmentedRangeMap::size_type SegmentedRangeMap::kUnknownSize;
+
+SegmentedRangeMap::SegmentedRangeMap(const SegmentedRangeMap &other)
+    : map_(other.map_), segments_(other.segments_) {
+  RebuildBases();
+}
+
+SegmentedRangeMap &SegmentedRangeMap::operator=(
+    const SegmentedRangeMap &other) {
+  if (this != &other) {
+    map_ = other.map_;
+    segments_ = other.segments_;
+    RebuildBases();
+  }
+  return *this;
+}
+
+void SegmentedRangeMap::AddRange(range_type type, size_type addr,
+                                 size_type size) {
+  map_.AddRange(type, addr, size);
+}
+
+bool SegmentedRangeMap::AddSegment(segment_type segment, size_type base,
+                                   size_type size) {
+  CHECK(size != 0 && size != kUnknownSize);
+  if (base + size < base || HasSegment(segment) ||
+      !IsWindowFree(base, size, nullptr)) {
+    return false;
+  }
+  Segment &added = segments_[segment];
+  added.base = base;
+  added.size = size;
+  bases_.emplace(base, &added);
+  return true;
+}
+
+void SegmentedRangeMap::RemoveSegment(segment_type segment) {
+  auto it = segments_.find(segment);
+  if (it == segments_.end()) {
+    return;
+  }
+  bases_.erase(it->second.base);
+  segments_.erase(it);
+}
+
+void SegmentedRangeMap::AddSegmentRange(segment_type segment, range_type type,
+                                        size_type offset, size_type size) {
+  Segment &target = GetSegment(segment);
+  CHECK(offset <= target.size && size <= target.size - offset);
+  target.map.AddRange(type, offset, size);
+}
+
+bool SegmentedRangeMap::Rebase(segment_type segment, size_type new_base) {
+  Segment &target = GetSegment(segment);
+  if (new_base + target.size < new_base ||
+      !IsWindowFree(new_base, target.size, &target)) {
+    return false;
+  }
+  bases_.erase(target.base);
+  target.base = new_base;
+  bases_.emplace(new_base, &target);
+  return true;
+}
+
+SegmentedRangeMap::size_type SegmentedRangeMap::GetBase(
+    segment_type segment) const {
+  auto it = segments_.find(segment);
+  CHECK(it != segments_.end());
+  return it->second.base;
+}
+
+bool SegmentedRangeMap::TryGetEntry(size_type addr, range_type *type,
+                                    size_type *size) const {
+  auto it = FindSegment(addr);
+  if (it != bases_.end() && it->first <= addr) {
+    return it->second->map.TryGetEntry(addr - it->first, type, size);
+  }
+  return map_.TryGetEntry(addr, type, size);
+}
+
+bool SegmentedRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(size != kUnknownSize);
+  if (size == 0) {
+    return true;
+  }
+  size_type end = ClipEnd(addr, size);
+  // Parts inside and between segments are checked by their own maps
+  auto it = FindSegment(addr);
+  while (addr < end) {
+    if (it != bases_.end() && it->first <= addr) {
+      const Segment &segment = *it->second;
+      size_type part_end = std::min(end, segment.base + segment.size);
+      if (!segment.map.IsRangeCovered(addr - segment.base, part_end - addr)) {
+        return false;
+      }
+      addr = part_end;
+      ++it;
+    } else {
+      size_type part_end =
+          (it == bases_.end()) ? end : std::min(end, it->first);
+      if (!map_.IsRangeCovered(addr, part_end - addr)) {
+        return false;
+      }
+      addr = part_end;
+    }
+  }
+  return true;
+}
+
+SegmentedRangeMap::Bases::const_iterator SegmentedRangeMap::FindSegment(
+    size_type addr) const {
+  auto it = bases_.upper_bound(addr);
+  if (it != bases_.begin()) {
+    auto prev = std::prev(it);
+    if (addr - prev->first < prev->second->size) {
+      return prev;
+    }
+  }
+  return it;
+}
+
+bool SegmentedRangeMap::IsWindowFree(size_type base, size_type size,
+                                     const Segment *ignored) const {
+  // Segments are disjoint, so only the last one that begins before the end
+  // of the window may reach into it
+  auto it = bases_.lower_bound(base + size);
+  while (it != bases_.begin()) {
+    --it;
+    if (it->second != ignored) {
+      return it->first + it->second->size <= base;
+    }
+  }
+  return true;
+}
+
+SegmentedRangeMap::Segment &SegmentedRangeMap::GetSegment(
+    segment_type segment) {
+  auto it = segments_.find(segment);
+  CHECK(it != segments_.end());
+  return it->second;
+}
+
+void SegmentedRangeMap::RebuildBases() {
+  bases_.clear();
+  for (auto &entry : segments_) {
+    bases_.emplace(entry.second.base, &entry.second);
+  }
+}
+
+}  // namespace rangemap
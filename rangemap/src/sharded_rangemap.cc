@@ -0,0 +1,371 @@
+#include "sharded_rangemap.h"
+#include <algorithm>
+
+namespace rangemap {
+
+const ShardedRangeMap::size_type ShardedRangeMap::kUnknownSize;
+
+ShardedRangeMap::ShardedRangeMap(const std::vector<size_type> &split_points)
+    : split_points_(split_points), tail_type_(0), tail_begin_(kUnknownSize) {
+  for (size_t i = 0; i < split_points_.size(); ++i) {
+    CHECK(split_points_[i] != 0);
+    CHECK(i == 0 || split_points_[i - 1] < split_points_[i]);
+  }
+  for (size_t i = 0; i <= split_points_.size(); ++i) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+std::vector<ShardedRangeMap::size_type> ShardedRangeMap::SplitByHighBits(
+    unsigned bits) {
+  CHECK(bits < 64);
+  std::vector<size_type> split_points;
+  for (size_type i = 1; i < (size_type(1) << bits); ++i) {
+    split_points.push_back(i << (64 - bits));
+  }
+  return split_points;
+}
+
+ShardedRangeMap::ShardLock::ShardLock(const ShardedRangeMap *owner, size_t lo,
+                                      size_t hi)
+    : owner_(owner), lo_(lo), hi_(hi) {
+  CHECK(lo_ <= hi_);
+  for (size_t i = lo_; i <= hi_; ++i) {
+    owner_->shards_[i]->mutex.lock();
+  }
+}
+
+ShardedRangeMap::ShardLock::~ShardLock() {
+  for (size_t i = lo_; i <= hi_; ++i) {
+    owner_->shards_[i]->mutex.unlock();
+  }
+}
+
+size_t ShardedRangeMap::ShardOf(size_type addr) const {
+  return UpperBound(split_points_.data(), split_points_.size(), addr);
+}
+
+ShardedRangeMap::size_type ShardedRangeMap::ShardBegin(size_t shard) const {
+  return (shard == 0) ? 0 : split_points_[shard - 1];
+}
+
+ShardedRangeMap::size_type ShardedRangeMap::ShardEnd(size_t shard) const {
+  return (shard + 1 < shards_.size()) ? split_points_[shard] : kUnknownSize;
+}
+
+void ShardedRangeMap::AddRange(range_type type, size_type addr,
+                               size_type size) {
+  if (size == 0) {
+    return;
+  }
+  if (size != kUnknownSize) {
+    // TODO: check overflow
+    CHECK(addr + size > addr);
+    size_type end = addr + size;
+    if (end < tail_begin_.load(std::memory_order_acquire)) {
+      // Can't meet the tail, only touched shards matter. Tail may have moved
+      // before the lock, check again.
+      ShardLock lock(this, ShardOf(addr), ShardOf(end - 1));
+      if (end < TailBegin()) {
+        FillShards(type, addr, end);
+        return;
+      }
+    }
+  }
+  ShardLock lock(this, 0, shards_.size() - 1);
+  if (size == kUnknownSize) {
+    AddRangeUnknownSizeLocked(type, addr);
+  } else {
+    AddRangeFixedSizeLocked(type, addr, addr + size);
+  }
+}
+
+void ShardedRangeMap::AddRangeRel(range_type type, size_type addr,
+                                  size_type size, size_type rel_addr) {
+  CHECK(rel_addr != RangeMap::kNoRelative);
+  // TODO: check overflow
+  CHECK(rel_addr + addr >= addr);
+  AddRange(type, addr + rel_addr, size);
+}
+
+bool ShardedRangeMap::TryGetEntry(size_type addr, range_type *type,
+                                  size_type *size) const {
+  CHECK(addr != kUnknownSize);
+  // Lock more neighbours until the whole run is seen
+  size_t lo = ShardOf(addr);
+  size_t hi = lo;
+  while (true) {
+    size_t want_lo = lo;
+    size_t want_hi = hi;
+    Run run;
+    bool is_found;
+    {
+      ShardLock lock(this, lo, hi);
+      if (addr >= TailBegin()) {
+        *type = tail_type_;
+        *size = kUnknownSize;
+        return true;
+      }
+      is_found = FindRun(addr, lo, hi, &run, &want_lo, &want_hi);
+    }
+    if (!is_found) {
+      return false;
+    }
+    if (want_lo == lo && want_hi == hi) {
+      *type = run.type;
+      *size = run.end - run.begin;
+      return true;
+    }
+    lo = want_lo;
+    hi = want_hi;
+  }
+}
+
+bool ShardedRangeMap::IsRangeCovered(size_type addr, size_type size) const {
+  CHECK(size != kUnknownSize);
+  if (size == 0) {
+    return true;
+  }
+  size_type tail_begin = tail_begin_.load(std::memory_order_acquire);
+  while (true) {
+    if (addr >= tail_begin) {
+      return true;
+    }
+    // Tail covers the rest
+    size_type end = std::min(ClipEnd(addr, size), tail_begin);
+    size_t lo = ShardOf(addr);
+    size_t hi = ShardOf(end - 1);
+    ShardLock lock(this, lo, hi);
+    if (TailBegin() != tail_begin) {
+      // Tail moved before the lock
+      tail_begin = TailBegin();
+      continue;
+    }
+    for (size_t i = lo; i <= hi; ++i) {
+      size_type piece_beg = std::max(addr, ShardBegin(i));
+      size_type piece_end = std::min(end, ShardEnd(i));
+      if (!shards_[i]->map.IsRangeCovered(piece_beg, piece_end - piece_beg)) {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+bool ShardedRangeMap::IsContinious() const {
+  ShardLock lock(this, 0, shards_.size() - 1);
+  if (HasTail()) {
+    return false;
+  }
+  bool is_first = true;
+  size_type prev_end = 0;
+  for (const auto &shard : shards_) {
+    const RangeMap &map = shard->map;
+    if (map.map_.empty()) {
+      continue;
+    }
+    if (!map.IsContinious()) {
+      return false;
+    }
+    if (!is_first && map.GetBegin(map.map_.begin()) != prev_end) {
+      return false;
+    }
+    is_first = false;
+    prev_end = map.GetEnd(std::prev(map.map_.end()));
+  }
+  return true;
+}
+
+void ShardedRangeMap::FillShards(range_type type, size_type begin,
+                                 size_type end) {
+  CHECK(begin < end);
+  for (size_t i = ShardOf(begin), last = ShardOf(end - 1); i <= last; ++i) {
+    size_type piece_beg = std::max(begin, ShardBegin(i));
+    size_type piece_end = std::min(end, ShardEnd(i));
+    shards_[i]->map.AddRange(type, piece_beg, piece_end - piece_beg);
+  }
+}
+
+bool ShardedRangeMap::FindRun(size_type addr, size_t lo, size_t hi, Run *run,
+                              size_t *want_lo, size_t *want_hi) const {
+  size_t shard = ShardOf(addr);
+  CHECK(lo <= shard && shard <= hi);
+  const RangeMap &map = shards_[shard]->map;
+  auto it = map.GetContaining(addr);
+  if (map.IsEnd(it)) {
+    return false;
+  }
+  run->begin = map.GetBegin(it);
+  run->end = map.GetEnd(it);
+  run->type = map.GetType(it);
+
+  // Join the last entries of the previous shards
+  size_t first = shard;
+  while (first > 0 && run->begin == ShardBegin(first)) {
+    if (first == lo) {
+      *want_lo = std::min(*want_lo, first - 1);
+      break;
+    }
+    const RangeMap &prev = shards_[first - 1]->map;
+    if (prev.map_.empty()) {
+      break;
+    }
+    auto last = std::prev(prev.map_.end());
+    if (prev.GetType(last) != run->type || prev.GetEnd(last) != run->begin) {
+      break;
+    }
+    run->begin = prev.GetBegin(last);
+    --first;
+  }
+
+  // Join the first entries of the next shards
+  size_t last = shard;
+  while (last + 1 < shards_.size() && run->end == ShardEnd(last)) {
+    if (last == hi) {
+      *want_hi = std::max(*want_hi, last + 1);
+      break;
+    }
+    const RangeMap &next = shards_[last + 1]->map;
+    if (next.map_.empty()) {
+      break;
+    }
+    auto next_first = next.map_.begin();
+    if (next.GetType(next_first) != run->type ||
+        next.GetBegin(next_first) != run->end) {
+      break;
+    }
+    run->end = next.GetEnd(next_first);
+    ++last;
+  }
+  return true;
+}
+
+bool ShardedRangeMap::FindNextBegin(size_type addr, size_type *begin) const {
+  // Shard entries always go before the tail
+  for (size_t i = ShardOf(addr); i < shards_.size(); ++i) {
+    const RangeMap &map = shards_[i]->map;
+    auto it = map.map_.lower_bound(addr);
+    if (!map.IsEnd(it)) {
+      *begin = map.GetBegin(it);
+      return true;
+    }
+  }
+  if (HasTail() && TailBegin() >= addr) {
+    *begin = TailBegin();
+    return true;
+  }
+  return false;
+}
+
+void ShardedRangeMap::SetTail(range_type type, size_type begin) {
+  CHECK(begin != kUnknownSize);
+  tail_type_ = type;
+  // Pairs with the unlocked load in AddRange
+  tail_begin_.store(begin, std::memory_order_release);
+}
+
+void ShardedRangeMap::EraseRun(const Run &run) {
+  for (size_t i = ShardOf(run.begin), last = ShardOf(run.end - 1); i <= last;
+       ++i) {
+    // Run is made of whole entries, RemoveRange keeps the gap index in sync
+    shards_[i]->map.RemoveRange(run.begin, run.end - run.begin);
+  }
+}
+
+void ShardedRangeMap::MaybeAbsorbIntoTail() {
+  // Same as merge of the unknown size entry with the previous one
+  CHECK(HasTail());
+  size_type tail_begin = TailBegin();
+  if (tail_begin == 0) {
+    return;
+  }
+  Run run;
+  size_t want_lo, want_hi;
+  if (FindRun(tail_begin - 1, 0, shards_.size() - 1, &run, &want_lo,
+              &want_hi) &&
+      run.end == tail_begin && run.type == tail_type_) {
+    EraseRun(run);
+    SetTail(tail_type_, run.begin);
+  }
+}
+
+void ShardedRangeMap::AddRangeUnknownSizeLocked(range_type type,
+                                                size_type addr) {
+  if (addr == kUnknownSize) {
+    // No addresses to cover, kUnknownSize also means no tail
+    return;
+  }
+  if (HasTail() && addr >= TailBegin()) {
+    // Same type would be merged back into the tail
+    if (addr == TailBegin() || type == tail_type_) {
+      return;
+    }
+    // Tail gets fixed size, new one starts at addr
+    FillShards(tail_type_, TailBegin(), addr);
+    SetTail(type, addr);
+    return;
+  }
+
+  // Can spawn only 1 range after the entry that contains addr
+  size_type base_beg = addr;
+  Run run;
+  size_t want_lo, want_hi;
+  if (FindRun(addr, 0, shards_.size() - 1, &run, &want_lo, &want_hi)) {
+    base_beg = run.end;
+  }
+  size_type next_beg;
+  if (FindNextBegin(base_beg, &next_beg)) {
+    if (next_beg > base_beg) {
+      FillShards(type, base_beg, next_beg);
+      if (HasTail() && next_beg == TailBegin() && type == tail_type_) {
+        MaybeAbsorbIntoTail();
+      }
+    }
+    return;
+  }
+  CHECK(!HasTail());
+  if (base_beg == kUnknownSize) {
+    return;
+  }
+  SetTail(type, base_beg);
+  MaybeAbsorbIntoTail();
+}
+
+void ShardedRangeMap::AddRangeFixedSizeLocked(range_type type,
+                                              size_type begin,
+                                              size_type end) {
+  size_type tail_begin = TailBegin();
+  if (!HasTail() || end < tail_begin) {
+    FillShards(type, begin, end);
+    return;
+  }
+  if (begin >= tail_begin) {
+    // Tail takes the range if it starts at the same addr, otherwise tail is
+    // cut and the range is added after it
+    ClearTail();
+    if (begin == tail_begin) {
+      FillShards(tail_type_, tail_begin, end);
+    } else {
+      FillShards(tail_type_, tail_begin, begin);
+      FillShards(type, begin, end);
+    }
+    return;
+  }
+
+  Run run;
+  size_t want_lo, want_hi;
+  bool is_gap_before_tail = !FindRun(tail_begin - 1, 0, shards_.size() - 1,
+                                     &run, &want_lo, &want_hi);
+  FillShards(type, begin, tail_begin);
+  if (is_gap_before_tail && type == tail_type_) {
+    // Last piece is merged into the tail, the rest is covered by it
+    MaybeAbsorbIntoTail();
+    return;
+  }
+  if (end > tail_begin) {
+    ClearTail();
+    FillShards(tail_type_, tail_begin, end);
+  }
+}
+
+}  // namespace rangemap
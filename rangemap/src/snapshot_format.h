@@ -0,0 +1,82 @@
+// -*- C++ -*-
+#ifndef RANGEMAP_SNAPSHOT_FORMAT_INCLUDE_H
+#define RANGEMAP_SNAPSHOT_FORMAT_INCLUDE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "utils.h"
+
+namespace rangemap {
+namespace snapshot {
+
+// Layout of the file written by RangeMap::SaveTo():
+//
+//   [Header, zero padded to kPageSize]
+//   [begins: uint64_t x count, padded to kPageSize]
+//   [types:  uint64_t x count, padded to kPageSize]
+//   [sizes:  uint64_t x count, padded to kPageSize]
+//
+// Integers are in host byte order, byte_order tells if it matches. Every
+// section starts at a page, so mapped arrays are aligned.
+const char kMagic[8] = {'R', 'N', 'G', 'M', 'A', 'P', '\0', '\0'};
+const uint32_t kVersion = 1;
+const uint32_t kByteOrder = 0x01020304;
+const uint64_t kPageSize = 4096;
+
+// Header flags
+const uint64_t kFlagContinious = 1;
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t count;
+  uint64_t flags;
+  uint64_t begins_offset;
+  uint64_t types_offset;
+  uint64_t sizes_offset;
+  uint64_t file_size;
+  // Covers [begins_offset, file_size)
+  uint64_t payload_checksum;
+  // Covers the header up to this field
+  uint64_t header_checksum;
+};
+
+static_assert(offsetof(Header, header_checksum) % sizeof(uint64_t) == 0,
+              "Header is checksummed by words");
+static_assert(sizeof(Header) <= kPageSize, "Header takes the first page");
+
+inline uint64_t AlignToPage(uint64_t offset) {
+  return (offset + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+// Streaming checksum over 64-bit words, all sections are made of them
+class Checksum {
+ public:
+  Checksum() : hash_(0x9e3779b97f4a7c15ULL) {}
+
+  void Update(const void *data, size_t size) {
+    CHECK(size % sizeof(uint64_t) == 0);
+    const uint64_t *words = static_cast<const uint64_t *>(data);
+    for (size_t i = 0; i < size / sizeof(uint64_t); ++i) {
+      uint64_t h = hash_ ^ (words[i] * 0xc2b2ae3d27d4eb4fULL);
+      hash_ = ((h << 31) | (h >> 33)) * 0x9e3779b185ebca87ULL;
+    }
+  }
+
+  uint64_t Get() const { return hash_; }
+
+ private:
+  uint64_t hash_;
+};
+
+inline uint64_t HeaderChecksum(const Header &header) {
+  Checksum checksum;
+  checksum.Update(&header, offsetof(Header, header_checksum));
+  return checksum.Get();
+}
+
+}  // namespace snapshot
+}  // namespace rangemap
+
+#endif  // RANGEMAP_SNAPSHOT_FORMAT_INCLUDE_H
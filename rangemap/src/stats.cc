@@ -0,0 +1,115 @@
+#include "stats.h"
+#include <atomic>
+#include <cstdio>
+#include "utils.h"
+
+namespace rangemap {
+namespace stats {
+
+namespace {
+
+const char *const kEventNames[kEventCount] = {
+    "merge_next",  "merge_prev",  "merge_both",       "entry_move",
+    "fixed_size_step", "erase_entry", "cursor_cover_step"};
+
+const char *const kOpNames[kOpCount] = {
+    "AddRange",          "AddRanges",            "TryAddRangeStrict",
+    "RemoveRange",       "AssignRange",          "TryGetEntry",
+    "TryGetEntries",     "IsRangeCovered",       "FindGapAtLeast",
+    "Merge",             "FindFirstUncovered",   "CursorTryGetEntry",
+    "CursorIsRangeCovered", "ForEachGap",        "ForEachInRange",
+    "IsContinious",      "SaveTo"};
+
+// Relaxed: values are only read by dumps, no ordering with the maps
+std::atomic<uint64_t> g_events[kEventCount];
+std::atomic<uint64_t> g_buckets[kOpCount][kBucketCount];
+std::atomic<uint64_t> g_sums[kOpCount];
+
+// Bit width of ns - 1, that is ceil(log2(ns))
+size_t GetBucketIndex(uint64_t ns) {
+  size_t bucket = 0;
+  for (uint64_t rest = (ns == 0) ? 0 : ns - 1;
+       rest != 0 && bucket + 1 < kBucketCount; rest >>= 1) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+thread_local size_t ScopedTimer::depth_ = 0;
+
+void Count(Event event, uint64_t n) {
+  CHECK(event < kEventCount);
+  g_events[event].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Record(Op op, uint64_t ns) {
+  CHECK(op < kOpCount);
+  g_buckets[op][GetBucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+  g_sums[op].fetch_add(ns, std::memory_order_relaxed);
+}
+
+uint64_t GetCount(Event event) {
+  CHECK(event < kEventCount);
+  return g_events[event].load(std::memory_order_relaxed);
+}
+
+uint64_t GetBucket(Op op, size_t bucket) {
+  CHECK(op < kOpCount && bucket < kBucketCount);
+  return g_buckets[op][bucket].load(std::memory_order_relaxed);
+}
+
+void Reset() {
+  for (auto &event : g_events) {
+    event.store(0, std::memory_order_relaxed);
+  }
+  for (size_t op = 0; op < kOpCount; ++op) {
+    for (auto &bucket : g_buckets[op]) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    g_sums[op].store(0, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace stats
+
+std::string DumpStats() {
+  using namespace stats;
+  std::string out;
+  char line[160];
+  out += "# TYPE rangemap_events_total counter\n";
+  for (size_t event = 0; event < kEventCount; ++event) {
+    std::snprintf(line, sizeof(line),
+                  "rangemap_events_total{event=\"%s\"} %llu\n",
+                  kEventNames[event],
+                  (unsigned long long)GetCount(Event(event)));
+    out += line;
+  }
+  out += "# TYPE rangemap_latency_ns histogram\n";
+  for (size_t op = 0; op < kOpCount; ++op) {
+    // Buckets are cumulative, bucket i ends at 2^i ns. The last one is
+    // unbounded, it goes to +Inf only.
+    uint64_t count = 0;
+    for (size_t bucket = 0; bucket + 1 < kBucketCount; ++bucket) {
+      count += GetBucket(Op(op), bucket);
+      std::snprintf(line, sizeof(line),
+                    "rangemap_latency_ns_bucket{op=\"%s\",le=\"%llu\"} %llu\n",
+                    kOpNames[op], (unsigned long long)(uint64_t(1) << bucket),
+                    (unsigned long long)count);
+      out += line;
+    }
+    count += GetBucket(Op(op), kBucketCount - 1);
+    std::snprintf(line, sizeof(line),
+                  "rangemap_latency_ns_bucket{op=\"%s\",le=\"+Inf\"} %llu\n"
+                  "rangemap_latency_ns_sum{op=\"%s\"} %llu\n"
+                  "rangemap_latency_ns_count{op=\"%s\"} %llu\n",
+                  kOpNames[op], (unsigned long long)count, kOpNames[op],
+                  (unsigned long long)g_sums[op].load(std::memory_order_relaxed),
+                  kOpNames[op], (unsigned long long)count);
+    out += line;
+  }
+  return out;
+}
+
+}  // namespace rangemap
@@ -3,6 +3,10 @@
 
 #include "rangemap.h"
 #include "gtest/gtest.h"
+#include <algorithm>
+#include <map>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace rangemap {
@@ -11,13 +15,10 @@ class RangeMapTest : public ::testing::Test {
 protected:
   struct TestEntry {
     TestEntry(size_t type_, uint64_t beg_, uint64_t end_)
-        : type(type_), beg(beg_), end(end_), rel_addr(RangeMap::kNoRelative) {}
-    TestEntry(size_t type_, uint64_t beg_, uint64_t end_, uint64_t rel_addr_)
-        : type(type_), beg(beg_), end(end_), rel_addr(rel_addr_) {}
+        : type(type_), beg(beg_), end(end_) {}
     size_t type;
     uint64_t beg;
     uint64_t end;
-    uint64_t rel_addr;
   };
 
   void AddRange(int ind, uint64_t addr, uint64_t size) {
@@ -34,6 +35,49 @@ protected:
       ASSERT_GE(it->first, prev_end);
       prev_end = range_map_.GetEnd(it);
     }
+    ASSERT_TRUE(IsGapIndexConsistent(range_map_));
+    ASSERT_TRUE(IsStatsConsistent(range_map_));
+  }
+
+  // Gap index has the same gaps as the walk over entries
+  static bool IsGapIndexConsistent(const RangeMap &range_map) {
+    std::vector<std::pair<uint64_t, uint64_t>> expected, actual;
+    range_map.ForEachGap(0, RangeMap::kUnknownSize,
+                         [&](uint64_t addr, uint64_t size) {
+                           expected.emplace_back(addr, addr + size);
+                           return true;
+                         });
+    range_map.gaps_.ForEach([&](uint64_t begin, uint64_t end) {
+      actual.emplace_back(begin, end);
+    });
+    return expected == actual && actual.size() == range_map.gaps_.Count();
+  }
+
+  // Coverage counters are the same as sums over entries
+  static bool IsStatsConsistent(const RangeMap &range_map) {
+    std::map<size_t, std::pair<uint64_t, size_t>> expected;
+    uint64_t total = 0;
+    for (auto it = range_map.map_.begin(); it != range_map.map_.end(); ++it) {
+      if (range_map.IsUnknownSize(it)) {
+        continue;
+      }
+      expected[it->second.type].first += it->second.size;
+      ++expected[it->second.type].second;
+      total += it->second.size;
+    }
+    for (const auto &type : expected) {
+      if (range_map.CoveredBytes(type.first) != type.second.first ||
+          range_map.EntryCount(type.first) != type.second.second) {
+        return false;
+      }
+    }
+    // Types without entries keep zero counters
+    for (const auto &type : range_map.stats_) {
+      if (type.second.entries == 0 && type.second.bytes != 0) {
+        return false;
+      }
+    }
+    return total == range_map.TotalCoveredBytes();
   }
 
   void AssertRangeMap(const std::vector<TestEntry> &ranges) {
@@ -45,7 +89,38 @@ protected:
       EXPECT_EQ(ranges[i].beg, iter->first);
       EXPECT_EQ(ranges[i].end, range_map_.GetEnd(iter));
       EXPECT_EQ(ranges[i].type, iter->second.type);
-      EXPECT_EQ(ranges[i].rel_addr, iter->second.rel_addr);
+    }
+  }
+
+  // Entries are sorted and do not overlap
+  static bool IsConsistent(const RangeMap &range_map) {
+    if (!IsGapIndexConsistent(range_map) || !IsStatsConsistent(range_map)) {
+      return false;
+    }
+    for (auto it = range_map.map_.begin(); it != range_map.map_.end(); ++it) {
+      auto next = std::next(it);
+      if (next != range_map.map_.end() &&
+          range_map.GetEnd(it) > next->first) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Both maps have exactly the same entries
+  static void AssertSameEntries(const RangeMap &expected,
+                                const RangeMap &actual) {
+    ASSERT_TRUE(IsGapIndexConsistent(expected));
+    ASSERT_TRUE(IsGapIndexConsistent(actual));
+    ASSERT_TRUE(IsStatsConsistent(expected));
+    ASSERT_TRUE(IsStatsConsistent(actual));
+    ASSERT_EQ(expected.map_.size(), actual.map_.size());
+    auto exp_it = expected.map_.begin();
+    auto act_it = actual.map_.begin();
+    for (; exp_it != expected.map_.end(); ++exp_it, ++act_it) {
+      EXPECT_EQ(exp_it->first, act_it->first);
+      EXPECT_EQ(exp_it->second.type, act_it->second.type);
+      EXPECT_EQ(exp_it->second.size, act_it->second.size);
     }
   }
 
@@ -73,11 +148,92 @@ protected:
   void AssertContinious(bool is_continious) {
     AssertConsistency();
     EXPECT_EQ(is_continious, range_map_.IsContinious());
+    EXPECT_EQ(is_continious, range_map_.IsContiniousSlow());
   }
 
   RangeMap range_map_;
 };
 
+// What AssertSameAnswers compares besides TryGetEntry
+struct SameAnswersOptions {
+  // Sizes of IsRangeCovered probes grow as size * 2 + 1, not by 7
+  bool is_doubling_sizes = false;
+  // TryGetEntries with sorted and reversed addresses
+  bool is_batched = false;
+};
+
+template <class T, class = void>
+struct HasIsContinious : std::false_type {};
+template <class T>
+struct HasIsContinious<T, decltype(void(&T::IsContinious))>
+    : std::true_type {};
+
+template <class T, class = void>
+struct HasTryGetEntries : std::false_type {};
+template <class T>
+struct HasTryGetEntries<T, decltype(void(&T::TryGetEntries))>
+    : std::true_type {};
+
+// Compare answers of another map implementation with RangeMap on [0, limit).
+// IsContinious is compared if T has it.
+template <class T>
+void AssertSameAnswers(const RangeMap &rm, const T &other, uint64_t limit,
+                       const SameAnswersOptions &options = {}) {
+  typedef typename T::size_type size_type;
+  typedef typename T::range_type range_type;
+  auto to_wide_size = [](size_type size) -> uint64_t {
+    return (size == T::kUnknownSize) ? RangeMap::kUnknownSize : size;
+  };
+  for (uint64_t addr = 0; addr < limit; ++addr) {
+    uint64_t t1 = 0, sz1 = 0;
+    range_type t2 = 0;
+    size_type sz2 = 0;
+    bool found = rm.TryGetEntry(addr, &t1, &sz1);
+    ASSERT_EQ(found, other.TryGetEntry(addr, &t2, &sz2)) << addr;
+    if (found) {
+      ASSERT_EQ(t1, t2) << addr;
+      ASSERT_EQ(sz1, to_wide_size(sz2)) << addr;
+    }
+    for (uint64_t size = 1; addr + size <= limit;
+         size = options.is_doubling_sizes ? size * 2 + 1 : size + 7) {
+      ASSERT_EQ(rm.IsRangeCovered(addr, size),
+                other.IsRangeCovered(addr, size))
+          << addr << " " << size;
+    }
+  }
+  if constexpr (HasIsContinious<T>::value) {
+    ASSERT_EQ(rm.IsContinious(), other.IsContinious());
+  }
+
+  if constexpr (HasTryGetEntries<T>::value) {
+    if (!options.is_batched) {
+      return;
+    }
+    std::vector<size_type> addrs;
+    for (uint64_t addr = 0; addr < limit; ++addr) {
+      addrs.push_back(addr);
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+      std::vector<range_type> types(addrs.size());
+      std::vector<size_type> sizes(addrs.size());
+      std::vector<uint64_t> found(BitmaskWords(addrs.size()));
+      other.TryGetEntries(addrs, types, sizes, found);
+      for (size_t i = 0; i < addrs.size(); ++i) {
+        uint64_t t, sz;
+        bool is_found = rm.TryGetEntry(addrs[i], &t, &sz);
+        ASSERT_EQ(is_found, GetBit(found, i)) << addrs[i];
+        if (is_found) {
+          ASSERT_EQ(t, types[i]);
+          ASSERT_EQ(sz, to_wide_size(sizes[i]));
+        }
+      }
+      std::reverse(addrs.begin(), addrs.end());
+    }
+  } else {
+    ASSERT_FALSE(options.is_batched) << "No TryGetEntries";
+  }
+}
+
 } // namespace rangemap
 
 #endif // RANGEMAP_TEST_INCLUDE
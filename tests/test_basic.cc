@@ -1,4 +1,32 @@
 #include "range_test.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <iterator>
+#include <random>
+#include <tuple>
+#include <type_traits>
+
+// Calls of the global operator new, see RangeMapTest.Reserve
+static std::atomic<size_t> g_new_calls(0);
+
+void *operator new(size_t size) {
+  g_new_calls.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  g_new_calls.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
 
 namespace rangemap {
 
@@ -390,6 +418,39 @@ TEST_F(RangeMapTest, AddRangeUnknownSizeFix1) {
     });
 }
 
+TEST_F(RangeMapTest, AddRangeUnknownSizeCut) {
+  AddRange(1, 10, RangeMap::kUnknownSize);
+  AddRange(2, 20, 100);
+  AssertRangeMap({
+      {1, 10, 20},
+      {2, 20, 120}
+    });
+
+  AddRange(3, 200, RangeMap::kUnknownSize);
+  AddRange(3, 300, RangeMap::kUnknownSize);
+  AssertRangeMap({
+      {1, 10, 20},
+      {2, 20, 120},
+      {3, 200, RangeMap::kUnknownSize}
+    });
+
+  AddRange(3, 150, 50);
+  AssertRangeMap({
+      {1, 10, 20},
+      {2, 20, 120},
+      {3, 150, RangeMap::kUnknownSize}
+    });
+}
+
+TEST_F(RangeMapTest, AddRangeMergeThrough) {
+  AddRange(1, 30, 10);
+  AddRange(1, 50, 10);
+  AddRange(1, 40, 30);
+  AssertRangeMap({
+      {1, 30, 70}
+    });
+}
+
 TEST_F(RangeMapTest, AddRangeNullSize) {
   AddRange(0, 10, 0);
   AssertRangeMap({{}});
@@ -493,6 +554,173 @@ TEST_F(RangeMapTest, AddRangeRelative) {
 
 }
 
+TEST_F(RangeMapTest, AddRangesBulk) {
+  AddRange(1, 20, 10);
+  std::vector<RangeMap::RangeSpec> specs = {
+      {2, 50, 10}, {3, 0, 40}, {2, 35, 15}, {4, 55, 20}, {3, 0, 0}};
+  range_map_.AddRanges(specs);
+  AssertRangeMap({
+      {3, 0, 20},
+      {1, 20, 30},
+      {3, 30, 40},
+      {2, 40, 60},
+      {4, 60, 75}
+    });
+
+  specs = {{5, 100, RangeMap::kUnknownSize}, {6, 80, 30}, {6, 120, 10}};
+  range_map_.AddRanges(specs);
+  AssertRangeMap({
+      {3, 0, 20},
+      {1, 20, 30},
+      {3, 30, 40},
+      {2, 40, 60},
+      {4, 60, 75},
+      {6, 80, 100},
+      {5, 100, 110},
+      {6, 120, 130}
+    });
+}
+
+TEST_F(RangeMapTest, AddRangesSameAsAddRange) {
+  std::mt19937_64 rng(3);
+  for (int round = 0; round < 200; ++round) {
+    std::vector<RangeMap::RangeSpec> specs;
+    for (int i = 0; i < 30; ++i) {
+      uint64_t size = (rng() % 16 == 0) ? RangeMap::kUnknownSize : rng() % 20;
+      specs.push_back({rng() % 4, rng() % 200, size});
+    }
+    bool is_sorted = (round % 2 == 0);
+    if (is_sorted) {
+      std::sort(specs.begin(), specs.end(),
+                [](const RangeMap::RangeSpec &a, const RangeMap::RangeSpec &b) {
+                  return a.addr < b.addr;
+                });
+    }
+
+    RangeMap expected;
+    RangeMap actual;
+    // Some entries before the bulk
+    for (int i = 0; i < 5; ++i) {
+      uint64_t type = rng() % 4, addr = rng() % 200, size = rng() % 20;
+      expected.AddRange(type, addr, size);
+      actual.AddRange(type, addr, size);
+    }
+    if (round % 4 < 2) {
+      // Tail that most of the specs end before
+      uint64_t type = rng() % 4, addr = 150 + rng() % 50;
+      expected.AddRange(type, addr, RangeMap::kUnknownSize);
+      actual.AddRange(type, addr, RangeMap::kUnknownSize);
+    }
+    for (const auto &spec : specs) {
+      expected.AddRange(spec.type, spec.addr, spec.size);
+    }
+    actual.AddRanges(specs, is_sorted);
+    AssertSameEntries(expected, actual);
+  }
+}
+
+TEST_F(RangeMapTest, Merge) {
+  std::mt19937_64 rng(21);
+  for (int round = 0; round < 200; ++round) {
+    RangeMap higher, lower;
+    for (int i = 0; i < 20; ++i) {
+      uint64_t size = (rng() % 16 == 0) ? RangeMap::kUnknownSize : rng() % 20;
+      RangeMap &map = (i % 2 == 0) ? higher : lower;
+      map.AddRange(rng() % 3, rng() % 200, size);
+    }
+    RangeMap expected = higher;
+    for (auto entry : lower) {
+      uint64_t size = (entry.end == RangeMap::kUnknownSize)
+                          ? RangeMap::kUnknownSize
+                          : entry.end - entry.begin;
+      expected.AddRange(entry.type, entry.begin, size);
+    }
+    higher.Merge(lower);
+    AssertSameEntries(expected, higher);
+  }
+}
+
+TEST_F(RangeMapTest, ParallelBuild) {
+  std::mt19937_64 rng(23);
+  for (size_t threads : {1, 2, 3, 8}) {
+    std::vector<std::vector<RangeMap::RangeSpec>> sources(7);
+    std::vector<Span<const RangeMap::RangeSpec>> spans;
+    RangeMap expected;
+    for (auto &source : sources) {
+      for (int i = 0; i < 50; ++i) {
+        source.push_back({rng() % 3, rng() % 1000, 1 + rng() % 30});
+      }
+      expected.AddRanges(source);
+      spans.emplace_back(source.data(), source.size());
+    }
+    RangeMap actual = RangeMap::ParallelBuild(spans, threads);
+    AssertSameEntries(expected, actual);
+  }
+  RangeMap empty = RangeMap::ParallelBuild({}, 4);
+  EXPECT_TRUE(empty.begin() == empty.end());
+}
+
+TEST_F(RangeMapTest, SetOperations) {
+  const size_t kNone = 100;
+  std::mt19937_64 rng(29);
+  // Type at addr or kNone
+  auto get_type = [&](const RangeMap &map, uint64_t addr) {
+    uint64_t type, size;
+    return map.TryGetEntry(addr, &type, &size) ? type : kNone;
+  };
+  for (int round = 0; round < 200; ++round) {
+    RangeMap a, b;
+    for (int i = 0; i < 20; ++i) {
+      uint64_t size = (rng() % 16 == 0) ? RangeMap::kUnknownSize : rng() % 30;
+      RangeMap &map = (i % 2 == 0) ? a : b;
+      map.AddRange(rng() % 3, rng() % 300, size);
+    }
+    RangeMap intersection = RangeMap::Intersect(a, b);
+    RangeMap difference = RangeMap::Subtract(a, b);
+    ASSERT_TRUE(IsConsistent(intersection));
+    ASSERT_TRUE(IsConsistent(difference));
+    // Types of the parts reported by Diff
+    std::vector<std::pair<size_t, size_t>> changes(400, {kNone, kNone});
+    uint64_t prev_end = 0;
+    std::pair<size_t, size_t> prev_types(kNone, kNone);
+    RangeMap::Diff(a, b, [&](uint64_t begin, uint64_t end,
+                             const size_t *old_type, const size_t *new_type) {
+      EXPECT_LT(begin, end);
+      EXPECT_LE(prev_end, begin);
+      std::pair<size_t, size_t> types(old_type ? *old_type : kNone,
+                                      new_type ? *new_type : kNone);
+      EXPECT_NE(types.first, types.second);
+      // Same neighbour parts are joined
+      EXPECT_TRUE(begin != prev_end || types != prev_types);
+      for (uint64_t addr = begin; addr < end && addr < changes.size();
+           ++addr) {
+        changes[addr] = types;
+      }
+      prev_end = end;
+      prev_types = types;
+      return true;
+    });
+    for (uint64_t addr : {uint64_t(0), uint64_t(1) << 40}) {
+      for (uint64_t i = 0; i < changes.size(); ++i) {
+        uint64_t at = addr + i;
+        size_t a_type = get_type(a, at);
+        size_t b_type = get_type(b, at);
+        size_t expected = (b_type != kNone) ? a_type : kNone;
+        ASSERT_EQ(expected, get_type(intersection, at)) << at;
+        expected = (b_type == kNone) ? a_type : kNone;
+        ASSERT_EQ(expected, get_type(difference, at)) << at;
+        if (addr == 0) {
+          std::pair<size_t, size_t> types(kNone, kNone);
+          if (a_type != b_type) {
+            types = {a_type, b_type};
+          }
+          ASSERT_EQ(types, changes[at]) << at;
+        }
+      }
+    }
+  }
+}
+
 TEST_F(RangeMapTest, RangeCover) {
   // [5, 55]
   AddRange(1, 5, 50);
@@ -596,7 +824,95 @@ TEST_F(RangeMapTest, GetType) {
   AssertGetType({3, 30, 50}, 30, 50);
 }
 
+TEST_F(RangeMapTest, GetTypeBatch) {
+  for (uint64_t i = 0; i < 64; ++i) {
+    AddRange(i % 3, i * 10, 5 + i % 6);
+  }
+  AddRange(7, 1000, RangeMap::kUnknownSize);
+
+  std::vector<uint64_t> sorted_addrs;
+  for (uint64_t addr = 0; addr < 1100; addr += 3) {
+    sorted_addrs.push_back(addr);
+  }
+  std::vector<uint64_t> shuffled_addrs(sorted_addrs.rbegin(),
+                                       sorted_addrs.rend());
+  for (const auto &addrs : {sorted_addrs, shuffled_addrs}) {
+    std::vector<uint64_t> types(addrs.size()), sizes(addrs.size());
+    std::vector<uint64_t> found(BitmaskWords(addrs.size()), ~uint64_t(0));
+    size_t found_count =
+        range_map_.TryGetEntries(addrs, types, sizes, found);
+
+    size_t expected_count = 0;
+    for (size_t i = 0; i < addrs.size(); ++i) {
+      uint64_t t, sz;
+      bool is_found = range_map_.TryGetEntry(addrs[i], &t, &sz);
+      ASSERT_EQ(is_found, GetBit(found, i)) << addrs[i];
+      if (is_found) {
+        ++expected_count;
+        EXPECT_EQ(t, types[i]);
+        EXPECT_EQ(sz, sizes[i]);
+      }
+    }
+    EXPECT_EQ(expected_count, found_count);
+  }
+}
+
+TEST_F(RangeMapTest, Cursor) {
+  for (uint64_t i = 0; i < 64; ++i) {
+    AddRange(i % 3, i * 10, 5 + i % 6);
+  }
+  AddRange(7, 1000, RangeMap::kUnknownSize);
+
+  // Forward, backward and random walks give the same answers
+  std::mt19937_64 rng(7);
+  std::vector<uint64_t> addrs;
+  for (uint64_t addr = 0; addr < 1100; ++addr) {
+    addrs.push_back(addr);
+  }
+  std::vector<uint64_t> reversed_addrs(addrs.rbegin(), addrs.rend());
+  std::vector<uint64_t> random_addrs;
+  for (int i = 0; i < 1000; ++i) {
+    random_addrs.push_back(rng() % 1100);
+  }
+  for (const auto &stream : {addrs, reversed_addrs, random_addrs}) {
+    RangeMap::Cursor cursor(range_map_);
+    for (uint64_t addr : stream) {
+      uint64_t t1 = 0, t2 = 0, sz1 = 0, sz2 = 0;
+      bool is_found = range_map_.TryGetEntry(addr, &t1, &sz1);
+      ASSERT_EQ(is_found, cursor.TryGetEntry(addr, &t2, &sz2)) << addr;
+      if (is_found) {
+        EXPECT_EQ(t1, t2);
+        EXPECT_EQ(sz1, sz2);
+      }
+      for (uint64_t size = 1; size < 40; size += 3) {
+        ASSERT_EQ(range_map_.IsRangeCovered(addr, size),
+                  cursor.IsRangeCovered(addr, size))
+            << addr << " " << size;
+      }
+    }
+    EXPECT_EQ(stream.size() * 14, cursor.HitCount() + cursor.MissCount());
+  }
+
+  // Sequential stream finds almost everything near the last entry
+  RangeMap::Cursor cursor(range_map_);
+  uint64_t t, sz;
+  for (uint64_t addr : addrs) {
+    cursor.TryGetEntry(addr, &t, &sz);
+  }
+  EXPECT_EQ(1u, cursor.MissCount());
+
+  // Update makes the cursor search again
+  AddRange(8, 2000, 10);
+  ASSERT_TRUE(cursor.TryGetEntry(2005, &t, &sz));
+  EXPECT_EQ(8u, t);
+  EXPECT_EQ(2u, cursor.MissCount());
+}
+
 TEST_F(RangeMapTest, Continious) {
+  AssertContinious(true);
+  EXPECT_EQ(0u, range_map_.GapCount());
+  EXPECT_EQ(0u, range_map_.GetSpan());
+
   AddRange(0, 10, 10);
   AssertRangeMap({
       {0, 10, 20}
@@ -609,6 +925,8 @@ TEST_F(RangeMapTest, Continious) {
       {1, 30, 40},
     });
   AssertContinious(false);
+  EXPECT_EQ(1u, range_map_.GapCount());
+  EXPECT_EQ(30u, range_map_.GetSpan());
 
   AddRange(2, 20, 10);
   AssertRangeMap({
@@ -626,6 +944,8 @@ TEST_F(RangeMapTest, Continious) {
       {3, 40, RangeMap::kUnknownSize}
     });
   AssertContinious(false);
+  EXPECT_EQ(0u, range_map_.GapCount());
+  EXPECT_EQ(RangeMap::kUnknownSize, range_map_.GetSpan());
 
   AddRange(3, 30, 10);
   AssertRangeMap({
@@ -644,6 +964,8 @@ TEST_F(RangeMapTest, Continious) {
       {3, 40, 1030}
     });
   AssertContinious(true);
+  EXPECT_EQ(0u, range_map_.GapCount());
+  EXPECT_EQ(1020u, range_map_.GetSpan());
 
   return;
   AddRange(4, 1030, RangeMap::kUnknownSize);
@@ -668,11 +990,516 @@ TEST_F(RangeMapTest, Continious) {
   AssertContinious(true);
 }
 
+namespace {
+
+// Counts calls to new_delete_resource
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t allocs = 0;
+  size_t deallocs = 0;
+
+ private:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    ++allocs;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void *ptr, size_t bytes, size_t alignment) override {
+    ++deallocs;
+    std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+  }
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+}  // namespace
+
+TEST_F(RangeMapTest, Reserve) {
+  CountingResource resource;
+  {
+    RangeMap map(&resource);
+    map.AddRange(1, 0, 10);
+    // Counters of a type are made by its first entry and stay
+    map.AddRange(0, 20, 10);
+    map.AddRange(2, 40, 10);
+    map.RemoveRange(20, 30);
+
+    map.Reserve(1010);
+    size_t allocs = resource.allocs;
+    size_t new_calls = g_new_calls.load();
+    for (uint64_t i = 1; i <= 1000; ++i) {
+      map.AddRange(i % 2, i * 20, 10);
+    }
+    EXPECT_EQ(allocs, resource.allocs);
+    // Split and join entries, gap nodes are freed and reused
+    for (int round = 0; round < 100; ++round) {
+      map.AssignRange(2, 22, 3);
+      map.RemoveRange(22, 3);
+      map.AddRange(1, 22, 3);
+    }
+    EXPECT_EQ(allocs, resource.allocs);
+    EXPECT_EQ(new_calls, g_new_calls.load());
+
+    // Copy gets a pool over the same upstream, moves take the pool along
+    RangeMap copy(map);
+    EXPECT_GT(resource.allocs, allocs);
+    allocs = resource.allocs;
+    RangeMap moved(std::move(copy));
+    EXPECT_EQ(allocs, resource.allocs);
+    // Moved-from map gets a pool over the same upstream
+    copy.AddRange(1, 0, 10);
+    EXPECT_GT(resource.allocs, allocs);
+    uint64_t t, sz;
+    ASSERT_TRUE(moved.TryGetEntry(20000, &t, &sz));
+    EXPECT_EQ(0u, t);
+    EXPECT_TRUE(copy.IsContinious());
+    map = moved;
+    map = std::move(copy);
+    EXPECT_TRUE(map.IsContinious());
+    EXPECT_FALSE(moved.IsContinious());
+
+    // Vector growth moves maps instead of copying them
+    static_assert(std::is_nothrow_move_constructible<RangeMap>::value, "");
+    static_assert(std::is_nothrow_move_assignable<RangeMap>::value, "");
+    std::vector<RangeMap> maps;
+    maps.emplace_back(&resource);
+    maps[0].AddRange(1, 0, 10);
+    allocs = resource.allocs;
+    for (size_t i = 0; i < 16; ++i) {
+      maps.emplace_back(std::move(maps.back()));
+    }
+    EXPECT_EQ(allocs, resource.allocs);
+  }
+  EXPECT_EQ(resource.allocs, resource.deallocs);
+}
 
 TEST_F(RangeMapTest, Gaps) {
-  // TODO: test gaps finding
-  return;
-  ASSERT_TRUE(false);
+  typedef std::vector<std::pair<uint64_t, uint64_t>> Gaps;
+  auto get_gaps = [this](uint64_t addr, uint64_t size) {
+    Gaps gaps;
+    range_map_.ForEachGap(addr, size, [&](uint64_t gap, uint64_t gap_size) {
+      gaps.emplace_back(gap, gap + gap_size);
+      return true;
+    });
+    return gaps;
+  };
+  EXPECT_EQ(Gaps({{5, 15}}), get_gaps(5, 10));
+
+  AddRange(1, 10, 10);
+  AddRange(2, 30, 10);
+  AssertConsistency();
+  EXPECT_EQ(Gaps({{0, 10}, {20, 30}, {40, 50}}), get_gaps(0, 50));
+  EXPECT_EQ(Gaps({{20, 30}}), get_gaps(15, 20));
+  EXPECT_EQ(Gaps(), get_gaps(12, 5));
+
+  // Stop on false
+  size_t calls = 0;
+  range_map_.ForEachGap(0, 50, [&](uint64_t, uint64_t) {
+    ++calls;
+    return false;
+  });
+  EXPECT_EQ(1u, calls);
+
+  uint64_t addr, size;
+  ASSERT_TRUE(range_map_.FindGapAtLeast(10, &addr, &size));
+  EXPECT_EQ(0u, addr);
+  EXPECT_EQ(10u, size);
+  ASSERT_TRUE(range_map_.FindGapAtLeast(10, &addr, &size, 1));
+  EXPECT_EQ(20u, addr);
+  ASSERT_TRUE(range_map_.FindGapAtLeast(11, &addr, &size));
+  EXPECT_EQ(40u, addr);
+  EXPECT_EQ(RangeMap::kUnknownSize - 40, size);
+  ASSERT_TRUE(range_map_.FindGapAtLeast(3, &addr, &size, 27));
+  EXPECT_EQ(27u, addr);
+  EXPECT_EQ(3u, size);
+
+  // Nothing after unknown size
+  AddRange(3, 45, RangeMap::kUnknownSize);
+  AssertConsistency();
+  EXPECT_EQ(Gaps({{40, 45}}), get_gaps(35, RangeMap::kUnknownSize));
+  EXPECT_FALSE(range_map_.FindGapAtLeast(11, &addr, &size));
+  // Tail is cut by the fixed range after it
+  AddRange(4, 100, 10);
+  AssertConsistency();
+  EXPECT_EQ(Gaps({{40, 45}, {110, RangeMap::kUnknownSize}}),
+            get_gaps(35, RangeMap::kUnknownSize));
+  ASSERT_TRUE(range_map_.FindGapAtLeast(11, &addr, &size));
+  EXPECT_EQ(110u, addr);
+  // Covered space is not changed
+  AddRange(4, 45, 10);
+  AssertConsistency();
+  EXPECT_EQ(Gaps({{40, 45}, {110, 120}}), get_gaps(35, 85));
+}
+
+TEST_F(RangeMapTest, ForEachInRange) {
+  typedef std::vector<std::tuple<uint64_t, uint64_t, size_t>> Entries;
+  auto get_entries = [this](uint64_t addr, uint64_t size) {
+    Entries entries;
+    range_map_.ForEachInRange(
+        addr, size, [&](uint64_t begin, uint64_t end, size_t type) {
+          entries.emplace_back(begin, end, type);
+          return true;
+        });
+    // Same entries through iterators
+    Entries iterated;
+    for (const auto &entry : range_map_.EntriesInRange(addr, size)) {
+      iterated.emplace_back(entry.begin, entry.end, entry.type);
+    }
+    EXPECT_EQ(entries, iterated);
+    return entries;
+  };
+  EXPECT_EQ(Entries(), get_entries(0, RangeMap::kUnknownSize));
+  EXPECT_TRUE(range_map_.begin() == range_map_.end());
+
+  AddRange(1, 10, 10);
+  AddRange(2, 30, 10);
+  AddRange(3, 50, RangeMap::kUnknownSize);
+  AssertConsistency();
+  EXPECT_EQ(Entries({{10, 20, 1}, {30, 40, 2}}), get_entries(15, 20));
+  EXPECT_EQ(Entries({{30, 40, 2}}), get_entries(20, 11));
+  EXPECT_EQ(Entries(), get_entries(20, 10));
+  EXPECT_EQ(Entries(), get_entries(5, 0));
+  // Empty range has no entries, also inside or at the start of one
+  EXPECT_EQ(Entries(), get_entries(15, 0));
+  EXPECT_EQ(Entries(), get_entries(10, 0));
+  EXPECT_EQ(Entries(), get_entries(60, 0));
+  EXPECT_EQ(Entries({{30, 40, 2}, {50, RangeMap::kUnknownSize, 3}}),
+            get_entries(39, 12));
+  EXPECT_EQ(Entries({{50, RangeMap::kUnknownSize, 3}}), get_entries(1000, 1));
+  EXPECT_EQ(3, std::distance(range_map_.begin(), range_map_.end()));
+  EXPECT_EQ(30u, (*std::prev(range_map_.end(), 2)).begin);
+
+  // Stop on false
+  size_t calls = 0;
+  range_map_.ForEachInRange(0, RangeMap::kUnknownSize,
+                            [&](uint64_t, uint64_t, size_t) {
+                              ++calls;
+                              return false;
+                            });
+  EXPECT_EQ(1u, calls);
+}
+
+TEST_F(RangeMapTest, WrappingQueries) {
+  // Sizes that run past the end of the address space are clipped there
+  const uint64_t kHuge = RangeMap::kUnknownSize - 1;
+  AddRange(1, 10, 10);
+  AddRange(2, 30, RangeMap::kUnknownSize);
+  AssertConsistency();
+  size_t count = 0;
+  range_map_.ForEachInRange(15, kHuge, [&](uint64_t, uint64_t, size_t) {
+    ++count;
+    return true;
+  });
+  EXPECT_EQ(2u, count);
+  EXPECT_EQ(1, std::distance(range_map_.EntriesInRange(25, kHuge).begin(),
+                             range_map_.EntriesInRange(25, kHuge).end()));
+  std::vector<std::pair<uint64_t, uint64_t>> gaps;
+  range_map_.ForEachGap(5, kHuge, [&](uint64_t gap, uint64_t gap_size) {
+    gaps.emplace_back(gap, gap_size);
+    return true;
+  });
+  EXPECT_EQ((std::vector<std::pair<uint64_t, uint64_t>>{{5, 5}, {20, 10}}),
+            gaps);
+
+  RangeMap::Cursor cursor(range_map_);
+  uint64_t uncovered = 0;
+  EXPECT_TRUE(range_map_.IsRangeCovered(40, kHuge));
+  EXPECT_TRUE(cursor.IsRangeCovered(40, kHuge));
+  EXPECT_FALSE(range_map_.FindFirstUncovered(40, kHuge, &uncovered));
+  EXPECT_FALSE(range_map_.IsRangeCovered(15, kHuge));
+  EXPECT_FALSE(cursor.IsRangeCovered(15, kHuge));
+  EXPECT_TRUE(range_map_.FindFirstUncovered(15, kHuge, &uncovered));
+  EXPECT_EQ(20u, uncovered);
+
+  // Removes up to the end, the tail is cut
+  range_map_.RemoveRange(40, kHuge);
+  AssertConsistency();
+  AssertRangeMap({{1, 10, 20}, {2, 30, 40}});
+}
+
+TEST_F(RangeMapTest, TryAddRangeStrict) {
+  RangeMap::EntryView conflict;
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(1, 10, 10, &conflict));
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(2, 30, 10, &conflict));
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(3, 25, 0, &conflict));
+  AssertRangeMap({{1, 10, 20}, {2, 30, 40}});
+
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 5, 6, &conflict));
+  EXPECT_EQ(10u, conflict.begin);
+  EXPECT_EQ(20u, conflict.end);
+  EXPECT_EQ(1u, conflict.type);
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 19, 5, &conflict));
+  EXPECT_EQ(10u, conflict.begin);
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 20, 11, &conflict));
+  EXPECT_EQ(30u, conflict.begin);
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 0, 100));
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 25, RangeMap::kUnknownSize));
+  // Wraps around the address space
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, RangeMap::kUnknownSize - 5, 10));
+  AssertRangeMap({{1, 10, 20}, {2, 30, 40}});
+
+  // Neighbours of the same type are merged
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(1, 20, 10));
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(2, 40, RangeMap::kUnknownSize));
+  AssertRangeMap({{1, 10, 30}, {2, 30, RangeMap::kUnknownSize}});
+
+  // Unknown size tail takes the rest
+  EXPECT_FALSE(range_map_.TryAddRangeStrict(3, 1000, 1, &conflict));
+  EXPECT_EQ(30u, conflict.begin);
+  EXPECT_EQ(RangeMap::kUnknownSize, conflict.end);
+  EXPECT_EQ(2u, conflict.type);
+  EXPECT_TRUE(range_map_.TryAddRangeStrict(3, 0, 10));
+  AssertRangeMap({{3, 0, 10}, {1, 10, 30}, {2, 30, RangeMap::kUnknownSize}});
+}
+
+TEST_F(RangeMapTest, RemoveRange) {
+  range_map_.RemoveRange(10, 10);
+  AssertRangeMap({});
+
+  AddRange(1, 10, 10);
+  AddRange(2, 30, 10);
+  AddRange(3, 50, 10);
+  AddRange(4, 70, RangeMap::kUnknownSize);
+  // Nothing to remove
+  range_map_.RemoveRange(20, 10);
+  range_map_.RemoveRange(25, 0);
+  AssertRangeMap({{1, 10, 20}, {2, 30, 40}, {3, 50, 60},
+                  {4, 70, RangeMap::kUnknownSize}});
+  // Split
+  range_map_.RemoveRange(13, 2);
+  AssertRangeMap({{1, 10, 13}, {1, 15, 20}, {2, 30, 40}, {3, 50, 60},
+                  {4, 70, RangeMap::kUnknownSize}});
+  // Trim both sides and erase the middle
+  range_map_.RemoveRange(17, 36);
+  AssertRangeMap(
+      {{1, 10, 13}, {1, 15, 17}, {3, 53, 60}, {4, 70, RangeMap::kUnknownSize}});
+  // Unknown size tail keeps its size
+  range_map_.RemoveRange(60, 20);
+  AssertRangeMap(
+      {{1, 10, 13}, {1, 15, 17}, {3, 53, 60}, {4, 80, RangeMap::kUnknownSize}});
+  range_map_.RemoveRange(100, 10);
+  AssertRangeMap({{1, 10, 13},
+                  {1, 15, 17},
+                  {3, 53, 60},
+                  {4, 80, 100},
+                  {4, 110, RangeMap::kUnknownSize}});
+  // Up to the end
+  range_map_.RemoveRange(120, RangeMap::kUnknownSize);
+  AssertRangeMap(
+      {{1, 10, 13}, {1, 15, 17}, {3, 53, 60}, {4, 80, 100}, {4, 110, 120}});
+  range_map_.RemoveRange(0, RangeMap::kUnknownSize);
+  AssertRangeMap({});
+
+  // Gap after a removed tail is filled again
+  AddRange(5, 0, RangeMap::kUnknownSize);
+  range_map_.RemoveRange(10, RangeMap::kUnknownSize);
+  AddRange(6, 5, 10);
+  AssertRangeMap({{5, 0, 10}, {6, 10, 15}});
+}
+
+TEST_F(RangeMapTest, AssignRange) {
+  AddRange(1, 10, 10);
+  AddRange(2, 20, 10);
+  AddRange(1, 30, 10);
+  // Newest wins and merges with neighbours of the same type
+  range_map_.AssignRange(1, 20, 10);
+  AssertRangeMap({{1, 10, 40}});
+  range_map_.AssignRange(3, 15, 10);
+  AssertRangeMap({{1, 10, 15}, {3, 15, 25}, {1, 25, 40}});
+  range_map_.AssignRange(3, 0, 10);
+  AssertRangeMap({{3, 0, 10}, {1, 10, 15}, {3, 15, 25}, {1, 25, 40}});
+  range_map_.AssignRange(3, 5, 15);
+  AssertRangeMap({{3, 0, 25}, {1, 25, 40}});
+  range_map_.AssignRange(2, 50, 10);
+  range_map_.AssignRange(2, 40, 5);
+  AssertRangeMap({{3, 0, 25}, {1, 25, 40}, {2, 40, 45}, {2, 50, 60}});
+
+  // Unknown size
+  range_map_.AssignRange(4, 30, RangeMap::kUnknownSize);
+  AssertRangeMap({{3, 0, 25}, {1, 25, 30}, {4, 30, RangeMap::kUnknownSize}});
+  range_map_.AssignRange(5, 40, 10);
+  AssertRangeMap({{3, 0, 25},
+                  {1, 25, 30},
+                  {4, 30, 40},
+                  {5, 40, 50},
+                  {4, 50, RangeMap::kUnknownSize}});
+  range_map_.AssignRange(4, 40, 10);
+  AssertRangeMap({{3, 0, 25}, {1, 25, 30}, {4, 30, RangeMap::kUnknownSize}});
+  range_map_.AssignRange(1, 30, 5);
+  AssertRangeMap({{3, 0, 25}, {1, 25, 35}, {4, 35, RangeMap::kUnknownSize}});
+}
+
+TEST_F(RangeMapTest, RemoveAssignRandom) {
+  const size_t kSpace = 300;
+  const size_t kNone = 100;
+  std::mt19937_64 rng(7);
+  for (int round = 0; round < 50; ++round) {
+    range_map_ = RangeMap();
+    // Type of every address, first writer wins
+    std::vector<size_t> types(kSpace, kNone);
+    for (int i = 0; i < 60; ++i) {
+      uint64_t addr = rng() % 250;
+      uint64_t size = rng() % 40;
+      if (rng() % 3 != 0) {
+        size_t type = rng() % 3;
+        AddRange(type, addr, size);
+        for (uint64_t a = addr; a < addr + size; ++a) {
+          if (types[a] == kNone) {
+            types[a] = type;
+          }
+        }
+      } else if (rng() % 2 == 0) {
+        size_t type = rng() % 3;
+        range_map_.AssignRange(type, addr, size);
+        for (uint64_t a = addr; a < addr + size; ++a) {
+          types[a] = type;
+        }
+      } else {
+        if (rng() % 10 == 0) {
+          size = RangeMap::kUnknownSize;
+        }
+        range_map_.RemoveRange(addr, size);
+        for (uint64_t a = addr; a < kSpace && a - addr < size; ++a) {
+          types[a] = kNone;
+        }
+      }
+      AssertConsistency();
+      // Gaps between the first and the last mapped address
+      size_t gap_count = 0;
+      uint64_t first = kSpace, last = 0;
+      for (uint64_t a = 0; a < kSpace; ++a) {
+        if (types[a] != kNone) {
+          if (first != kSpace && types[a - 1] == kNone) {
+            ++gap_count;
+          }
+          first = std::min(first, a);
+          last = a + 1;
+        }
+      }
+      ASSERT_EQ(gap_count, range_map_.GapCount());
+      ASSERT_EQ(first == kSpace ? 0 : last - first, range_map_.GetSpan());
+      ASSERT_EQ(gap_count == 0, range_map_.IsContinious());
+      for (uint64_t a = 0; a < kSpace; ++a) {
+        uint64_t type, entry_size;
+        bool is_found = range_map_.TryGetEntry(a, &type, &entry_size);
+        ASSERT_EQ(types[a] != kNone, is_found) << a;
+        if (is_found) {
+          ASSERT_EQ(types[a], type) << a;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(RangeMapTest, GapsRandom) {
+  std::mt19937_64 rng(13);
+  for (int round = 0; round < 100; ++round) {
+    range_map_ = RangeMap();
+    for (int i = 0; i < 40; ++i) {
+      uint64_t size = (rng() % 20 == 0) ? RangeMap::kUnknownSize : rng() % 30;
+      AddRange(rng() % 3, rng() % 1000, size);
+      AssertConsistency();
+    }
+    for (int i = 0; i < 50; ++i) {
+      uint64_t min_size = 1 + rng() % 40;
+      uint64_t hint = rng() % 1100;
+      // First fitting gap by the walk
+      bool is_expected = false;
+      uint64_t expected_addr = 0, expected_size = 0;
+      range_map_.ForEachGap(hint, RangeMap::kUnknownSize,
+                            [&](uint64_t gap, uint64_t gap_size) {
+                              if (gap_size < min_size) {
+                                return true;
+                              }
+                              is_expected = true;
+                              expected_addr = gap;
+                              expected_size = gap_size;
+                              return false;
+                            });
+      uint64_t addr, size;
+      ASSERT_EQ(is_expected,
+                range_map_.FindGapAtLeast(min_size, &addr, &size, hint));
+      if (is_expected) {
+        EXPECT_EQ(expected_addr, addr);
+        EXPECT_EQ(expected_size, size);
+      }
+    }
+    for (int i = 0; i < 50; ++i) {
+      uint64_t addr = rng() % 1100;
+      uint64_t size = 1 + rng() % 200;
+      // First uncovered address by the walk
+      bool is_expected = false;
+      uint64_t expected = 0;
+      range_map_.ForEachGap(addr, size, [&](uint64_t gap, uint64_t) {
+        is_expected = true;
+        expected = gap;
+        return false;
+      });
+      uint64_t uncovered;
+      ASSERT_EQ(is_expected,
+                range_map_.FindFirstUncovered(addr, size, &uncovered));
+      ASSERT_EQ(!is_expected, range_map_.IsRangeCovered(addr, size));
+      if (is_expected) {
+        EXPECT_EQ(expected, uncovered);
+      }
+    }
+  }
+}
+
+TEST_F(RangeMapTest, CoverageStats) {
+  size_t type;
+  uint64_t addr;
+  EXPECT_EQ(0u, range_map_.TotalCoveredBytes());
+  EXPECT_EQ(0u, range_map_.EntryCount(0));
+  EXPECT_FALSE(range_map_.TryGetUnknownTail(&type, &addr));
+
+  AddRange(0, 10, 10);
+  AddRange(1, 30, 10);
+  AddRange(0, 20, 5);
+  AssertConsistency();
+  EXPECT_EQ(15u, range_map_.CoveredBytes(0));
+  EXPECT_EQ(1u, range_map_.EntryCount(0));
+  EXPECT_EQ(10u, range_map_.CoveredBytes(1));
+  EXPECT_EQ(25u, range_map_.TotalCoveredBytes());
+
+  // Tail is not counted until it gets a size
+  AddRange(2, 50, RangeMap::kUnknownSize);
+  AssertConsistency();
+  EXPECT_EQ(0u, range_map_.EntryCount(2));
+  EXPECT_EQ(25u, range_map_.TotalCoveredBytes());
+  ASSERT_TRUE(range_map_.TryGetUnknownTail(&type, &addr));
+  EXPECT_EQ(2u, type);
+  EXPECT_EQ(50u, addr);
+
+  AddRange(3, 60, RangeMap::kUnknownSize);
+  AssertConsistency();
+  EXPECT_EQ(10u, range_map_.CoveredBytes(2));
+  EXPECT_EQ(35u, range_map_.TotalCoveredBytes());
+  ASSERT_TRUE(range_map_.TryGetUnknownTail(&type, &addr));
+  EXPECT_EQ(3u, type);
+  EXPECT_EQ(60u, addr);
+
+  // Merge into the tail drops the range from counters
+  range_map_.RemoveRange(50, 10);
+  AddRange(3, 50, 10);
+  AssertConsistency();
+  EXPECT_EQ(0u, range_map_.EntryCount(3));
+  EXPECT_EQ(0u, range_map_.EntryCount(2));
+  EXPECT_EQ(25u, range_map_.TotalCoveredBytes());
+  ASSERT_TRUE(range_map_.TryGetUnknownTail(&type, &addr));
+  EXPECT_EQ(50u, addr);
+
+  range_map_.AssignRange(1, 12, 2);
+  AssertConsistency();
+  EXPECT_EQ(2u, range_map_.EntryCount(0));
+  EXPECT_EQ(13u, range_map_.CoveredBytes(0));
+  EXPECT_EQ(2u, range_map_.EntryCount(1));
+  EXPECT_EQ(12u, range_map_.CoveredBytes(1));
+
+  range_map_.RemoveRange(0, RangeMap::kUnknownSize);
+  AssertConsistency();
+  EXPECT_EQ(0u, range_map_.TotalCoveredBytes());
+  EXPECT_FALSE(range_map_.TryGetUnknownTail(&type, &addr));
 }
 
 TEST_F(RangeMapTest, Order) {
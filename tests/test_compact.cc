@@ -0,0 +1,98 @@
+#include "rangemap.h"
+#include "frozen_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <random>
+
+namespace rangemap {
+
+namespace {
+
+uint64_t ToWideSize(CompactRangeMap::size_type size) {
+  return (size == CompactRangeMap::kUnknownSize) ? RangeMap::kUnknownSize
+                                                 : size;
+}
+
+uint32_t ToCompactSize(uint64_t size) {
+  return (size == RangeMap::kUnknownSize) ? CompactRangeMap::kUnknownSize
+                                          : uint32_t(size);
+}
+
+// Same entries, then same answers on [0, limit)
+void AssertSameEntries(const RangeMap &rm, const CompactRangeMap &crm,
+                       uint64_t limit) {
+  auto it = crm.begin();
+  for (const auto &entry : rm) {
+    ASSERT_TRUE(it != crm.end());
+    EXPECT_EQ(entry.begin, (*it).begin);
+    EXPECT_EQ(entry.end, ToWideSize((*it).end));
+    EXPECT_EQ(entry.type, (*it).type);
+    ++it;
+  }
+  ASSERT_TRUE(it == crm.end());
+  AssertSameAnswers(rm, crm, limit);
+}
+
+}  // namespace
+
+TEST(CompactRangeMapTest, Footprint) {
+  // Entry is the type and the size, nothing else
+  EXPECT_EQ(8u, sizeof(CompactRangeMap::Entry));
+  EXPECT_EQ(16u, sizeof(RangeMap::Entry));
+  // Key and entry take at most half of the 64-bit ones
+  EXPECT_LE(2 * (sizeof(uint32_t) + sizeof(CompactRangeMap::Entry)),
+            sizeof(uint64_t) + sizeof(RangeMap::Entry));
+}
+
+TEST(CompactRangeMapTest, UnknownSize) {
+  CompactRangeMap crm;
+  crm.AddRange(1, 10, 10);
+  crm.AddRange(2, 100, CompactRangeMap::kUnknownSize);
+  uint8_t type;
+  uint32_t size;
+  ASSERT_TRUE(crm.TryGetEntry(0xfffffff0u, &type, &size));
+  EXPECT_EQ(2u, type);
+  EXPECT_EQ(CompactRangeMap::kUnknownSize, size);
+  uint32_t addr;
+  ASSERT_TRUE(crm.FindGapAtLeast(50, &addr, &size));
+  EXPECT_EQ(20u, addr);
+  EXPECT_EQ(80u, size);
+
+  // Frozen map is 64-bit
+  FrozenRangeMap frm = crm.Freeze();
+  uint64_t frozen_type, frozen_size;
+  ASSERT_TRUE(frm.TryGetEntry(0xfffffff0u, &frozen_type, &frozen_size));
+  EXPECT_EQ(2u, frozen_type);
+  EXPECT_EQ(FrozenRangeMap::kUnknownSize, frozen_size);
+}
+
+TEST(CompactRangeMapTest, SameAsRangeMap) {
+  const uint64_t limit = 300;
+  std::mt19937_64 rng(16);
+  for (int round = 0; round < 30; ++round) {
+    RangeMap rm;
+    CompactRangeMap crm;
+    for (int i = 0; i < 60; ++i) {
+      uint8_t type = rng() % 4;
+      uint64_t addr = rng() % (limit - 40);
+      uint64_t size = (rng() % 8 == 0) ? RangeMap::kUnknownSize : rng() % 40;
+      switch (rng() % 3) {
+        case 0:
+          rm.AddRange(type, addr, size);
+          crm.AddRange(type, addr, ToCompactSize(size));
+          break;
+        case 1:
+          rm.AssignRange(type, addr, size);
+          crm.AssignRange(type, addr, ToCompactSize(size));
+          break;
+        default:
+          rm.RemoveRange(addr, size);
+          crm.RemoveRange(addr, ToCompactSize(size));
+          break;
+      }
+    }
+    AssertSameEntries(rm, crm, limit);
+  }
+}
+
+}  // namespace rangemap
@@ -0,0 +1,111 @@
+#include "concurrent_rangemap.h"
+#include "range_test.h"
+#include <thread>
+
+namespace rangemap {
+
+class ConcurrentRangeMapTest : public RangeMapTest {};
+
+TEST_F(ConcurrentRangeMapTest, Publish) {
+  ConcurrentRangeMap crm;
+  auto reader = crm.GetReader();
+  uint64_t t, sz;
+
+  crm.AddRange(1, 10, 10);
+  EXPECT_EQ(1u, crm.PendingCount());
+  EXPECT_FALSE(reader.TryGetEntry(10, &t, &sz));
+
+  crm.Publish();
+  EXPECT_EQ(0u, crm.PendingCount());
+  ASSERT_TRUE(reader.TryGetEntry(10, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(10u, sz);
+  EXPECT_TRUE(reader.IsContinious());
+
+  crm.AddRangeRel(2, 0, 10, 30);
+  crm.Publish();
+  EXPECT_FALSE(reader.IsContinious());
+  EXPECT_TRUE(reader.IsRangeCovered(30, 10));
+  EXPECT_FALSE(reader.IsRangeCovered(10, 30));
+}
+
+TEST_F(ConcurrentRangeMapTest, ReaderSlots) {
+  ConcurrentRangeMap crm;
+  {
+    std::vector<ConcurrentRangeMap::Reader> readers;
+    for (size_t i = 0; i < ConcurrentRangeMap::kMaxReaders; ++i) {
+      readers.push_back(crm.GetReader());
+      EXPECT_TRUE(readers.back().IsValid());
+    }
+    // No free slot left
+    auto extra = crm.GetReader();
+    EXPECT_FALSE(extra.IsValid());
+    EXPECT_DEATH(extra.IsContinious(), "");
+  }
+  // Released slots are reused
+  auto reader = crm.GetReader();
+  EXPECT_TRUE(reader.IsValid());
+  EXPECT_TRUE(reader.Read([](const RangeMap &map) {
+    return !map.IsRangeCovered(0, 1);
+  }));
+}
+
+TEST_F(ConcurrentRangeMapTest, Stress) {
+  // Writer grows a continuous mapping [0, n * kStep), readers check that
+  // every version they see is consistent and never goes backward
+  const uint64_t kStep = 10;
+  const uint64_t kBatches = 300;
+  const uint64_t kBatchSize = 16;
+  const size_t kReaders = 4;
+
+  ConcurrentRangeMap crm;
+  std::atomic<bool> is_done(false);
+  std::atomic<size_t> bad_versions(0);
+  std::vector<std::thread> threads;
+  for (size_t r = 0; r < kReaders; ++r) {
+    threads.emplace_back([&crm, &is_done, &bad_versions]() {
+      auto reader = crm.GetReader();
+      uint64_t seen_end = 0;
+      while (!is_done.load()) {
+        bool is_ok = reader.Read([&](const RangeMap &map) {
+          if (!IsConsistent(map)) {
+            return false;
+          }
+          // Find the end of the mapping, it must be a multiple of kStep
+          uint64_t t, sz, end = 0;
+          while (map.TryGetEntry(end, &t, &sz)) {
+            end += kStep;
+          }
+          if (end < seen_end) {
+            return false;
+          }
+          seen_end = end;
+          return end == 0 ||
+                 (map.IsContinious() && map.IsRangeCovered(0, end) &&
+                  !map.IsRangeCovered(0, end + 1));
+        });
+        if (!is_ok) {
+          bad_versions.fetch_add(1);
+        }
+      }
+    });
+  }
+
+  uint64_t next = 0;
+  for (uint64_t batch = 0; batch < kBatches; ++batch) {
+    for (uint64_t i = 0; i < kBatchSize; ++i, ++next) {
+      crm.AddRange(next % 3, next * kStep, kStep);
+    }
+    crm.Publish();
+  }
+  is_done.store(true);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0u, bad_versions.load());
+
+  auto reader = crm.GetReader();
+  EXPECT_TRUE(reader.IsRangeCovered(0, next * kStep));
+}
+
+}  // namespace rangemap
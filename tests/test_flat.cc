@@ -0,0 +1,84 @@
+#include "flat_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <random>
+
+namespace rangemap {
+
+TEST(FlatRangeMapTest, AddRange) {
+  FlatRangeMap frm;
+  frm.AddRange(1, 10, 10);
+  frm.AddRange(2, 30, 10);
+  frm.AddRange(3, 10, 40);
+  ASSERT_EQ(4u, frm.Size());
+
+  uint64_t t, sz;
+  ASSERT_FALSE(frm.TryGetEntry(9, &t, &sz));
+  ASSERT_TRUE(frm.TryGetEntry(10, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(10u, sz);
+  ASSERT_TRUE(frm.TryGetEntry(25, &t, &sz));
+  EXPECT_EQ(3u, t);
+  EXPECT_EQ(10u, sz);
+  ASSERT_TRUE(frm.TryGetEntry(49, &t, &sz));
+  EXPECT_EQ(3u, t);
+  ASSERT_FALSE(frm.TryGetEntry(50, &t, &sz));
+
+  EXPECT_TRUE(frm.IsRangeCovered(10, 40));
+  EXPECT_FALSE(frm.IsRangeCovered(5, 10));
+  EXPECT_TRUE(frm.IsContinious());
+}
+
+TEST(FlatRangeMapTest, Merge) {
+  FlatRangeMap frm;
+  frm.AddRange(1, 50, 10);
+  frm.AddRange(1, 30, 10);
+  ASSERT_EQ(2u, frm.Size());
+  frm.AddRange(1, 40, 10);
+  ASSERT_EQ(1u, frm.Size());
+
+  uint64_t t, sz;
+  ASSERT_TRUE(frm.TryGetEntry(45, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(30u, sz);
+}
+
+TEST(FlatRangeMapTest, UnknownSize) {
+  FlatRangeMap frm;
+  frm.AddRange(1, 10, FlatRangeMap::kUnknownSize);
+  frm.AddRange(2, 20, FlatRangeMap::kUnknownSize);
+  EXPECT_FALSE(frm.IsContinious());
+
+  uint64_t t, sz;
+  ASSERT_TRUE(frm.TryGetEntry(15, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(10u, sz);
+  ASSERT_TRUE(frm.TryGetEntry(1000, &t, &sz));
+  EXPECT_EQ(2u, t);
+  EXPECT_EQ(FlatRangeMap::kUnknownSize, sz);
+
+  frm.AddRange(3, 20, 100);
+  ASSERT_TRUE(frm.TryGetEntry(20, &t, &sz));
+  EXPECT_EQ(2u, t);
+  EXPECT_EQ(100u, sz);
+  EXPECT_TRUE(frm.IsContinious());
+}
+
+TEST(FlatRangeMapTest, SameAsRangeMap) {
+  const uint64_t limit = 200;
+  std::mt19937_64 rng(42);
+  for (int round = 0; round < 20; ++round) {
+    RangeMap rm;
+    FlatRangeMap frm;
+    for (int i = 0; i < 40; ++i) {
+      uint64_t type = rng() % 4;
+      uint64_t addr = rng() % (limit - 20);
+      uint64_t size = (rng() % 8 == 0) ? RangeMap::kUnknownSize : rng() % 20;
+      rm.AddRange(type, addr, size);
+      frm.AddRange(type, addr, size);
+    }
+    AssertSameAnswers(rm, frm, limit);
+  }
+}
+
+}  // namespace rangemap
@@ -0,0 +1,74 @@
+#include "frozen_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <random>
+
+namespace rangemap {
+
+TEST(FrozenRangeMapTest, Empty) {
+  RangeMap rm;
+  FrozenRangeMap frm = rm.Freeze();
+  uint64_t t, sz;
+  EXPECT_EQ(0u, frm.Size());
+  EXPECT_FALSE(frm.TryGetEntry(0, &t, &sz));
+  EXPECT_FALSE(frm.IsRangeCovered(0, 1));
+  EXPECT_TRUE(frm.IsRangeCovered(0, 0));
+}
+
+TEST(FrozenRangeMapTest, Basic) {
+  RangeMap rm;
+  rm.AddRange(1, 10, 10);
+  rm.AddRange(2, 30, 10);
+  rm.AddRange(3, 40, RangeMap::kUnknownSize);
+  FrozenRangeMap frm = rm.Freeze();
+  ASSERT_EQ(3u, frm.Size());
+  EXPECT_FALSE(frm.IsContinious());
+
+  uint64_t t, sz;
+  EXPECT_FALSE(frm.TryGetEntry(9, &t, &sz));
+  ASSERT_TRUE(frm.TryGetEntry(19, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(10u, sz);
+  EXPECT_FALSE(frm.TryGetEntry(20, &t, &sz));
+  ASSERT_TRUE(frm.TryGetEntry(1 << 30, &t, &sz));
+  EXPECT_EQ(3u, t);
+  EXPECT_EQ(RangeMap::kUnknownSize, sz);
+
+  EXPECT_TRUE(frm.IsRangeCovered(30, 1000));
+  EXPECT_FALSE(frm.IsRangeCovered(15, 20));
+  EXPECT_GE(frm.MemoryUsage(), 3 * sizeof(uint64_t));
+}
+
+TEST(FrozenRangeMapTest, Continious) {
+  RangeMap rm;
+  for (uint64_t i = 0; i < 100; ++i) {
+    rm.AddRange(i, i * 2, 2);
+  }
+  FrozenRangeMap frm = rm.Freeze();
+  EXPECT_TRUE(frm.IsContinious());
+  EXPECT_TRUE(frm.IsRangeCovered(0, 200));
+  EXPECT_FALSE(frm.IsRangeCovered(0, 201));
+}
+
+TEST(FrozenRangeMapTest, SameAsRangeMap) {
+  // Sizes cover 1, 2 and 3 levels of the index
+  const uint64_t counts[] = {10, 200, 3000};
+  std::mt19937_64 rng(7);
+  for (uint64_t count : counts) {
+    const uint64_t limit = count * 4;
+    RangeMap rm;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t type = rng() % 3;
+      uint64_t addr = rng() % limit;
+      uint64_t size = (rng() % 64 == 0) ? RangeMap::kUnknownSize : rng() % 4;
+      rm.AddRange(type, addr, size);
+    }
+    SameAnswersOptions options;
+    options.is_doubling_sizes = true;
+    options.is_batched = true;
+    AssertSameAnswers(rm, rm.Freeze(), limit + 10, options);
+  }
+}
+
+}  // namespace rangemap
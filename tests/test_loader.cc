@@ -0,0 +1,258 @@
+#include "loader.h"
+#include "gtest/gtest.h"
+#include <elf.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace rangemap {
+
+namespace {
+
+const char kMaps[] =
+    "55d0c0a00000-55d0c0a02000 r--p 00000000 08:01 1234     /usr/bin/cat\n"
+    "55d0c0a02000-55d0c0a07000 r-xp 00002000 08:01 1234     /usr/bin/cat\n"
+    "55d0c1e3b000-55d0c1e5c000 rw-p 00000000 00:00 0        [heap]\n"
+    "7f1e2c000000-7f1e2c021000 rw-s 00000000 00:05 77       /dev/shm/a b\n"
+    "7ffc8d9d2000-7ffc8d9f3000 rw-p 00000000 00:00 0\n"
+    "ffffffffff600000-ffffffffff601000 --xp 00000000 00:00 0  [vsyscall]";
+
+std::vector<ProcMapsParser::Mapping> ParseInChunks(const std::string &text,
+                                                   size_t chunk_size,
+                                                   std::vector<std::string>
+                                                       *paths) {
+  std::vector<ProcMapsParser::Mapping> mappings;
+  auto fn = [&](const ProcMapsParser::Mapping &mapping) {
+    mappings.push_back(mapping);
+    paths->emplace_back(mapping.path);
+  };
+  ProcMapsParser parser;
+  for (size_t pos = 0; pos < text.size(); pos += chunk_size) {
+    size_t size = std::min(chunk_size, text.size() - pos);
+    EXPECT_TRUE(parser.Feed(text.data() + pos, size, fn));
+  }
+  EXPECT_TRUE(parser.Finish(fn));
+  return mappings;
+}
+
+// Function inside the test binary
+int LocalFunction(int x) { return x + 1; }
+
+}  // namespace
+
+TEST(LoaderTest, ProcMapsChunks) {
+  for (size_t chunk_size : {size_t(1), size_t(7), sizeof(kMaps)}) {
+    std::vector<std::string> paths;
+    auto mappings = ParseInChunks(kMaps, chunk_size, &paths);
+    ASSERT_EQ(6u, mappings.size());
+    EXPECT_EQ(0x55d0c0a02000u, mappings[1].begin);
+    EXPECT_EQ(0x55d0c0a07000u, mappings[1].end);
+    EXPECT_EQ(0x2000u, mappings[1].offset);
+    EXPECT_EQ(1234u, mappings[1].inode);
+    EXPECT_EQ(ProcMapsParser::kRead | ProcMapsParser::kExec,
+              mappings[1].perms);
+    EXPECT_EQ("/usr/bin/cat", paths[1]);
+    EXPECT_EQ("[heap]", paths[2]);
+    EXPECT_EQ(ProcMapsParser::kRead | ProcMapsParser::kWrite |
+                  ProcMapsParser::kShared,
+              mappings[3].perms);
+    EXPECT_EQ("/dev/shm/a b", paths[3]);
+    EXPECT_EQ("", paths[4]);
+    EXPECT_EQ(0xffffffffff601000u, mappings[5].end);
+  }
+}
+
+TEST(LoaderTest, ProcMapsMalformed) {
+  for (const char *line :
+       {"zz-10 r--p 0 08:01 1 /a\n", "20-10 r--p 0 08:01 1 /a\n",
+        "10-20 r-\n", "10-20 r--p 0 0801 1 /a\n",
+        "10-20 r--p 0 08:01 /a\n"}) {
+    ProcMapsParser parser;
+    EXPECT_FALSE(
+        parser.Feed(line, std::strlen(line),
+                    [](const ProcMapsParser::Mapping &) { FAIL(); }))
+        << line;
+  }
+  // Empty lines are skipped
+  ProcMapsParser parser;
+  size_t count = 0;
+  const char text[] = "\n10-20 r--p 0 08:01 1\n\n";
+  EXPECT_TRUE(parser.Feed(text, sizeof(text) - 1,
+                          [&](const ProcMapsParser::Mapping &) { ++count; }));
+  EXPECT_EQ(1u, count);
+}
+
+TEST(LoaderTest, LoadProcMaps) {
+  char path[] = "/tmp/rangemap_maps_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(ssize_t(sizeof(kMaps) - 1), write(fd, kMaps, sizeof(kMaps) - 1));
+  close(fd);
+
+  RangeMap map;
+  // Executable mappings only
+  ASSERT_TRUE(LoadProcMaps(
+      path,
+      [](const ProcMapsParser::Mapping &mapping, size_t *type) {
+        *type = mapping.inode;
+        return (mapping.perms & ProcMapsParser::kExec) != 0;
+      },
+      &map));
+  uint64_t type, size;
+  ASSERT_TRUE(map.TryGetEntry(0x55d0c0a03000, &type, &size));
+  EXPECT_EQ(1234u, type);
+  EXPECT_EQ(0x5000u, size);
+  EXPECT_FALSE(map.TryGetEntry(0x55d0c0a00000, &type, &size));
+  EXPECT_TRUE(map.IsRangeCovered(0xffffffffff600000, 0x1000));
+  EXPECT_EQ(0x6000u, map.TotalCoveredBytes());
+
+  // Type is 0 if fn does not set it
+  RangeMap untyped;
+  ASSERT_TRUE(LoadProcMaps(
+      path, [](const ProcMapsParser::Mapping &, size_t *) { return true; },
+      &untyped));
+  // Both /usr/bin/cat mappings are joined
+  EXPECT_EQ(5u, untyped.EntryCount(0));
+
+  EXPECT_FALSE(LoadProcMaps(
+      "/nonexistent/maps",
+      [](const ProcMapsParser::Mapping &, size_t *) { return true; }, &map));
+  std::remove(path);
+}
+
+TEST(LoaderTest, ElfSelf) {
+  std::unique_ptr<ElfFile> elf = ElfFile::Open("/proc/self/exe");
+  ASSERT_TRUE(elf);
+  ASSERT_NE(0u, elf->SegmentCount());
+  bool has_text = false;
+  for (size_t i = 0; i < elf->SectionCount(); ++i) {
+    has_text = has_text || elf->GetSection(i).name == ".text";
+  }
+  EXPECT_TRUE(has_text);
+
+  // Load base is the begin of the mapping of the file start minus the
+  // address of the first loadable segment
+  char exe[4096];
+  ssize_t exe_size = readlink("/proc/self/exe", exe, sizeof(exe));
+  ASSERT_GT(exe_size, 0);
+  std::string exe_path(exe, exe_size);
+  uint64_t file_begin = 0;
+  ProcMapsParser parser;
+  ASSERT_TRUE(parser.ParseFile(
+      "/proc/self/maps", [&](const ProcMapsParser::Mapping &mapping) {
+        if (mapping.path == exe_path && mapping.offset == 0 &&
+            file_begin == 0) {
+          file_begin = mapping.begin;
+        }
+      }));
+  ASSERT_NE(0u, file_begin);
+  uint64_t first_vaddr = ~uint64_t(0);
+  for (size_t i = 0; i < elf->SegmentCount(); ++i) {
+    ElfFile::Segment segment = elf->GetSegment(i);
+    if (segment.type == PT_LOAD) {
+      first_vaddr = std::min(first_vaddr, segment.vaddr);
+    }
+  }
+  uint64_t base = elf->IsRelocatable()
+                      ? file_begin - (first_vaddr & ~uint64_t(0xfff))
+                      : 0;
+
+  std::vector<RangeMap::RangeSpec> specs;
+  elf->AppendSegments(1, base, &specs);
+  RangeMap segments;
+  segments.AddRanges(specs);
+  uint64_t addr = reinterpret_cast<uint64_t>(&LocalFunction);
+  uint64_t type, size;
+  EXPECT_TRUE(segments.TryGetEntry(addr, &type, &size));
+
+  specs.clear();
+  elf->AppendSections(100, base, &specs);
+  RangeMap sections;
+  sections.AddRanges(specs);
+  ASSERT_TRUE(sections.TryGetEntry(addr, &type, &size));
+  EXPECT_EQ(".text", elf->GetSection(type - 100).name);
+}
+
+TEST(LoaderTest, ElfBroken) {
+  EXPECT_FALSE(ElfFile::Open("/nonexistent"));
+  char path[] = "/tmp/rangemap_elf_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  // Valid ident, program headers point out of the file
+  Elf64_Ehdr header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_type = ET_DYN;
+  header.e_phoff = 1 << 20;
+  header.e_phnum = 1;
+  header.e_phentsize = sizeof(Elf64_Phdr);
+  ASSERT_EQ(ssize_t(sizeof(header)), write(fd, &header, sizeof(header)));
+  close(fd);
+  EXPECT_FALSE(ElfFile::Open(path));
+  std::remove(path);
+}
+
+TEST(LoaderTest, ElfWrappingRanges) {
+  char path[] = "/tmp/rangemap_elf_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  // Only the first segment and section fit the address space with the base
+  const uint64_t kBase = 0x10000;
+  const uint64_t kMax = ~uint64_t(0);
+  struct {
+    Elf64_Ehdr header;
+    Elf64_Phdr segments[4];
+    Elf64_Shdr sections[2];
+  } file;
+  std::memset(&file, 0, sizeof(file));
+  std::memcpy(file.header.e_ident, ELFMAG, SELFMAG);
+  file.header.e_ident[EI_CLASS] = ELFCLASS64;
+  file.header.e_ident[EI_DATA] = ELFDATA2LSB;
+  file.header.e_type = ET_DYN;
+  file.header.e_phoff = offsetof(decltype(file), segments);
+  file.header.e_phnum = 4;
+  file.header.e_phentsize = sizeof(Elf64_Phdr);
+  file.header.e_shoff = offsetof(decltype(file), sections);
+  file.header.e_shnum = 2;
+  file.header.e_shentsize = sizeof(Elf64_Shdr);
+  const uint64_t kSegments[4][2] = {
+      {0x1000, 0x1000}, {kMax - 0x10, 0x100}, {kMax - 0x8000, 0x10},
+      {0x3000, kMax}};
+  for (size_t i = 0; i < 4; ++i) {
+    file.segments[i].p_type = PT_LOAD;
+    file.segments[i].p_vaddr = kSegments[i][0];
+    file.segments[i].p_memsz = kSegments[i][1];
+  }
+  const uint64_t kSections[2][2] = {{0x1000, 0x100}, {kMax - 0x100, 0x200}};
+  for (size_t i = 0; i < 2; ++i) {
+    file.sections[i].sh_type = SHT_PROGBITS;
+    file.sections[i].sh_flags = SHF_ALLOC;
+    file.sections[i].sh_addr = kSections[i][0];
+    file.sections[i].sh_size = kSections[i][1];
+  }
+  ASSERT_EQ(ssize_t(sizeof(file)), write(fd, &file, sizeof(file)));
+  close(fd);
+  std::unique_ptr<ElfFile> elf = ElfFile::Open(path);
+  std::remove(path);
+  ASSERT_TRUE(elf);
+
+  std::vector<RangeMap::RangeSpec> specs;
+  elf->AppendSegments(1, kBase, &specs);
+  ASSERT_EQ(1u, specs.size());
+  EXPECT_EQ(kBase + 0x1000, specs[0].addr);
+  EXPECT_EQ(0x1000u, specs[0].size);
+  specs.clear();
+  elf->AppendSections(100, kBase, &specs);
+  ASSERT_EQ(1u, specs.size());
+  EXPECT_EQ(100u, specs[0].type);
+  EXPECT_EQ(kBase + 0x1000, specs[0].addr);
+  EXPECT_EQ(0x100u, specs[0].size);
+}
+
+}  // namespace rangemap
@@ -0,0 +1,92 @@
+#include "mapped_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <random>
+
+namespace rangemap {
+
+namespace {
+
+std::string TempPath(const char *name) {
+  return ::testing::TempDir() + name;
+}
+
+// Flip one byte of the file at offset
+void CorruptFile(const std::string &path, long offset) {
+  std::FILE *file = std::fopen(path.c_str(), "r+b");
+  ASSERT_NE(nullptr, file);
+  ASSERT_EQ(0, std::fseek(file, offset, SEEK_SET));
+  int c = std::fgetc(file);
+  ASSERT_EQ(0, std::fseek(file, offset, SEEK_SET));
+  std::fputc(c ^ 0xff, file);
+  std::fclose(file);
+}
+
+}  // namespace
+
+TEST(MappedRangeMapTest, SameAsRangeMap) {
+  std::string path = TempPath("rangemap_same.bin");
+  std::mt19937_64 rng(11);
+  for (int round = 0; round < 4; ++round) {
+    RangeMap rm;
+    // Enough entries for several pages per section
+    for (int i = 0; i < 2000; ++i) {
+      uint64_t size = (rng() % 500 == 0) ? RangeMap::kUnknownSize : rng() % 8;
+      rm.AddRange(rng() % 4, rng() % 20000, size);
+    }
+    ASSERT_TRUE(rm.SaveTo(path));
+    auto mrm = MappedRangeMap::Open(path, true);
+    ASSERT_NE(nullptr, mrm);
+    SameAnswersOptions options;
+    options.is_doubling_sizes = true;
+    AssertSameAnswers(rm, *mrm, 20100, options);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(MappedRangeMapTest, Continious) {
+  std::string path = TempPath("rangemap_continious.bin");
+  RangeMap rm;
+  ASSERT_TRUE(rm.SaveTo(path));
+  auto mrm = MappedRangeMap::Open(path, true);
+  ASSERT_NE(nullptr, mrm);
+  EXPECT_EQ(0u, mrm->Size());
+  EXPECT_TRUE(mrm->IsContinious());
+  EXPECT_FALSE(mrm->IsRangeCovered(0, 1));
+
+  rm.AddRange(1, 10, 10);
+  rm.AddRange(2, 20, 10);
+  ASSERT_TRUE(rm.SaveTo(path));
+  mrm = MappedRangeMap::Open(path);
+  ASSERT_NE(nullptr, mrm);
+  EXPECT_EQ(2u, mrm->Size());
+  EXPECT_TRUE(mrm->IsContinious());
+  EXPECT_TRUE(mrm->IsRangeCovered(10, 20));
+  std::remove(path.c_str());
+}
+
+TEST(MappedRangeMapTest, BadFile) {
+  std::string path = TempPath("rangemap_bad.bin");
+  EXPECT_EQ(nullptr, MappedRangeMap::Open(path + ".missing"));
+
+  RangeMap rm;
+  for (uint64_t i = 0; i < 100; ++i) {
+    rm.AddRange(i % 3, i * 10, 5);
+  }
+  ASSERT_TRUE(rm.SaveTo(path));
+  ASSERT_NE(nullptr, MappedRangeMap::Open(path, true));
+
+  // Payload is checked only with is_verify
+  CorruptFile(path, 4096 + 8);
+  EXPECT_NE(nullptr, MappedRangeMap::Open(path));
+  EXPECT_EQ(nullptr, MappedRangeMap::Open(path, true));
+
+  // Header is always checked
+  ASSERT_TRUE(rm.SaveTo(path));
+  CorruptFile(path, 16);
+  EXPECT_EQ(nullptr, MappedRangeMap::Open(path));
+  std::remove(path.c_str());
+}
+
+}  // namespace rangemap
@@ -0,0 +1,113 @@
+#include "persistent_rangemap.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace rangemap {
+
+namespace {
+
+// Both maps have the same entries in the same order
+void AssertSameEntries(const RangeMap &expected,
+                       const PersistentRangeMap &actual) {
+  std::vector<RangeMap::EntryView> entries;
+  actual.ForEach([&](uint64_t begin, uint64_t size, size_t type) {
+    uint64_t end =
+        (size == RangeMap::kUnknownSize) ? RangeMap::kUnknownSize : begin + size;
+    entries.push_back({begin, end, type});
+  });
+  ASSERT_EQ(entries.size(), actual.Size());
+  size_t i = 0;
+  for (auto entry : expected) {
+    ASSERT_LT(i, entries.size());
+    EXPECT_EQ(entry.begin, entries[i].begin) << i;
+    EXPECT_EQ(entry.end, entries[i].end) << i;
+    EXPECT_EQ(entry.type, entries[i].type) << i;
+    ++i;
+  }
+  EXPECT_EQ(i, entries.size());
+}
+
+}  // namespace
+
+TEST(PersistentRangeMapTest, Snapshot) {
+  PersistentRangeMap map;
+  map.AddRange(1, 10, 10);
+  PersistentRangeMap old = map.Snapshot();
+  map.AddRange(2, 20, 10);
+  map.AddRange(1, 0, 40);
+
+  uint64_t type, size;
+  EXPECT_FALSE(old.TryGetEntry(25, &type, &size));
+  EXPECT_FALSE(old.IsRangeCovered(10, 11));
+  EXPECT_EQ(1u, old.Size());
+  ASSERT_TRUE(map.TryGetEntry(25, &type, &size));
+  EXPECT_EQ(2u, type);
+  EXPECT_TRUE(map.IsRangeCovered(0, 40));
+  EXPECT_EQ(3u, map.Size());
+
+  // Old version can be updated on its own
+  old.AddRange(3, 20, RangeMap::kUnknownSize);
+  ASSERT_TRUE(old.TryGetEntry(1000, &type, &size));
+  EXPECT_EQ(3u, type);
+  EXPECT_FALSE(map.TryGetEntry(1000, &type, &size));
+}
+
+TEST(PersistentRangeMapTest, SameAsRangeMap) {
+  std::mt19937_64 rng(31);
+  for (int round = 0; round < 100; ++round) {
+    RangeMap expected;
+    PersistentRangeMap actual;
+    std::vector<std::pair<RangeMap, PersistentRangeMap>> versions;
+    for (int i = 0; i < 60; ++i) {
+      uint64_t size = (rng() % 16 == 0) ? RangeMap::kUnknownSize : rng() % 30;
+      uint64_t type = rng() % 3, addr = rng() % 300;
+      expected.AddRange(type, addr, size);
+      actual.AddRange(type, addr, size);
+      AssertSameEntries(expected, actual);
+      if (i % 10 == 0) {
+        versions.emplace_back(expected, actual.Snapshot());
+      }
+    }
+    for (const auto &version : versions) {
+      AssertSameEntries(version.first, version.second);
+      for (uint64_t addr = 0; addr < 350; ++addr) {
+        uint64_t t1 = 0, t2 = 0, sz1 = 0, sz2 = 0;
+        bool found = version.first.TryGetEntry(addr, &t1, &sz1);
+        ASSERT_EQ(found, version.second.TryGetEntry(addr, &t2, &sz2));
+        EXPECT_EQ(t1, t2);
+        EXPECT_EQ(sz1, sz2);
+        ASSERT_EQ(version.first.IsRangeCovered(addr, 20),
+                  version.second.IsRangeCovered(addr, 20));
+      }
+    }
+  }
+}
+
+TEST(PersistentRangeMapTest, ReadersOfSnapshots) {
+  // Readers check their snapshot while the owner keeps updating
+  const uint64_t kStep = 10;
+  PersistentRangeMap map;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    map.AddRange(i % 2, i * kStep, kStep);
+  }
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([snapshot = map.Snapshot()]() {
+      for (int pass = 0; pass < 20; ++pass) {
+        EXPECT_TRUE(snapshot.IsRangeCovered(0, 1000 * kStep));
+        EXPECT_FALSE(snapshot.IsRangeCovered(0, 1000 * kStep + 1));
+      }
+    });
+  }
+  for (uint64_t i = 1000; i < 3000; ++i) {
+    map.AddRange(i % 2, i * kStep, kStep);
+  }
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  EXPECT_TRUE(map.IsRangeCovered(0, 3000 * kStep));
+}
+
+}  // namespace rangemap
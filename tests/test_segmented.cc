@@ -0,0 +1,136 @@
+#include "segmented_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <vector>
+
+namespace rangemap {
+
+TEST(SegmentedRangeMapTest, Rebase) {
+  SegmentedRangeMap srm;
+  srm.AddRange(1, 0, 100);
+  ASSERT_TRUE(srm.AddSegment(7, 1000, 100));
+  srm.AddSegmentRange(7, 2, 0, 10);
+  srm.AddSegmentRange(7, 3, 10, 10);
+  uint64_t type, size;
+  ASSERT_TRUE(srm.TryGetEntry(1015, &type, &size));
+  EXPECT_EQ(3u, type);
+  EXPECT_EQ(10u, size);
+  EXPECT_TRUE(srm.IsRangeCovered(1000, 20));
+  EXPECT_FALSE(srm.IsRangeCovered(1000, 21));
+
+  ASSERT_TRUE(srm.Rebase(7, 2000));
+  EXPECT_EQ(2000u, srm.GetBase(7));
+  EXPECT_FALSE(srm.TryGetEntry(1015, &type, &size));
+  ASSERT_TRUE(srm.TryGetEntry(2015, &type, &size));
+  EXPECT_EQ(3u, type);
+  EXPECT_TRUE(srm.IsRangeCovered(2000, 20));
+
+  // Segment hides absolute ranges
+  ASSERT_TRUE(srm.Rebase(7, 50));
+  ASSERT_TRUE(srm.TryGetEntry(49, &type, &size));
+  EXPECT_EQ(1u, type);
+  ASSERT_TRUE(srm.TryGetEntry(50, &type, &size));
+  EXPECT_EQ(2u, type);
+  EXPECT_FALSE(srm.TryGetEntry(70, &type, &size));
+  EXPECT_TRUE(srm.IsRangeCovered(0, 70));
+  EXPECT_FALSE(srm.IsRangeCovered(0, 71));
+
+  srm.RemoveSegment(7);
+  EXPECT_FALSE(srm.HasSegment(7));
+  EXPECT_TRUE(srm.IsRangeCovered(0, 100));
+}
+
+TEST(SegmentedRangeMapTest, Copy) {
+  SegmentedRangeMap copy;
+  uint64_t type, size;
+  {
+    SegmentedRangeMap srm;
+    srm.AddRange(1, 0, 100);
+    ASSERT_TRUE(srm.AddSegment(7, 1000, 100));
+    srm.AddSegmentRange(7, 2, 0, 10);
+    SegmentedRangeMap other(srm);
+    copy = srm;
+    // Changes of the source do not reach the copies
+    ASSERT_TRUE(srm.Rebase(7, 2000));
+    srm.RemoveSegment(7);
+    ASSERT_TRUE(other.TryGetEntry(1005, &type, &size));
+    EXPECT_EQ(2u, type);
+    SegmentedRangeMap moved(std::move(other));
+    ASSERT_TRUE(moved.TryGetEntry(1005, &type, &size));
+    EXPECT_EQ(2u, type);
+  }
+  ASSERT_TRUE(copy.TryGetEntry(1005, &type, &size));
+  EXPECT_EQ(2u, type);
+  EXPECT_TRUE(copy.IsRangeCovered(1000, 10));
+  EXPECT_FALSE(copy.AddSegment(8, 1050, 10));
+  ASSERT_TRUE(copy.Rebase(7, 50));
+  ASSERT_TRUE(copy.TryGetEntry(55, &type, &size));
+  EXPECT_EQ(2u, type);
+  EXPECT_EQ(1u, copy.SegmentCount());
+}
+
+TEST(SegmentedRangeMapTest, Overlap) {
+  SegmentedRangeMap srm;
+  ASSERT_TRUE(srm.AddSegment(1, 100, 100));
+  ASSERT_TRUE(srm.AddSegment(2, 300, 100));
+  EXPECT_FALSE(srm.AddSegment(1, 1000, 10));
+  EXPECT_FALSE(srm.AddSegment(3, 150, 10));
+  EXPECT_FALSE(srm.AddSegment(3, 50, 51));
+  EXPECT_FALSE(srm.AddSegment(3, 199, 102));
+  EXPECT_TRUE(srm.AddSegment(3, 200, 100));
+  EXPECT_FALSE(srm.AddSegment(4, SegmentedRangeMap::kUnknownSize - 5, 10));
+  EXPECT_EQ(3u, srm.SegmentCount());
+  EXPECT_FALSE(srm.Rebase(3, SegmentedRangeMap::kUnknownSize - 50));
+
+  EXPECT_FALSE(srm.Rebase(1, 250));
+  EXPECT_FALSE(srm.Rebase(1, 350));
+  // Own window does not count
+  EXPECT_TRUE(srm.Rebase(1, 50));
+  EXPECT_TRUE(srm.Rebase(1, 0));
+  EXPECT_TRUE(srm.Rebase(2, 350));
+  EXPECT_TRUE(srm.Rebase(3, 100));
+  EXPECT_EQ(0u, srm.GetBase(1));
+  EXPECT_EQ(350u, srm.GetBase(2));
+  EXPECT_EQ(100u, srm.GetBase(3));
+}
+
+TEST(SegmentedRangeMapTest, SameAsRangeMap) {
+  const uint64_t limit = 400;
+  std::mt19937_64 rng(17);
+  for (int round = 0; round < 20; ++round) {
+    SegmentedRangeMap srm;
+    struct Range {
+      uint64_t type;
+      uint64_t offset;
+      uint64_t size;
+    };
+    // Ranges of segment i, segments are 40 bytes wide
+    std::vector<std::vector<Range>> ranges(4);
+    for (uint32_t i = 0; i < ranges.size(); ++i) {
+      ASSERT_TRUE(srm.AddSegment(i, i * 100, 40));
+      for (int j = 0; j < 8; ++j) {
+        uint64_t offset = rng() % 40;
+        Range range = {rng() % 3, offset, rng() % (41 - offset)};
+        srm.AddSegmentRange(i, range.type, range.offset, range.size);
+        ranges[i].push_back(range);
+      }
+    }
+    for (int step = 0; step < 5; ++step) {
+      // Same ranges at absolute addresses
+      RangeMap rm;
+      for (uint32_t i = 0; i < ranges.size(); ++i) {
+        for (const Range &range : ranges[i]) {
+          rm.AddRange(range.type, srm.GetBase(i) + range.offset, range.size);
+        }
+      }
+      AssertSameAnswers(rm, srm, limit);
+      // Shuffle bases, only moves into free windows succeed
+      for (uint32_t i = 0; i < ranges.size(); ++i) {
+        srm.Rebase(i, rng() % (limit - 40));
+      }
+    }
+  }
+}
+
+}  // namespace rangemap
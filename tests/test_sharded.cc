@@ -0,0 +1,131 @@
+#include "sharded_rangemap.h"
+#include "range_test.h"
+#include "gtest/gtest.h"
+#include <random>
+#include <thread>
+
+namespace rangemap {
+
+TEST(ShardedRangeMapTest, AddRange) {
+  ShardedRangeMap srm({16, 32});
+  EXPECT_EQ(3u, srm.ShardCount());
+  EXPECT_TRUE(srm.IsContinious());
+
+  // Crosses both borders, but looks as one entry
+  srm.AddRange(1, 10, 30);
+  uint64_t t, sz;
+  ASSERT_TRUE(srm.TryGetEntry(20, &t, &sz));
+  EXPECT_EQ(1u, t);
+  EXPECT_EQ(30u, sz);
+  EXPECT_TRUE(srm.IsRangeCovered(10, 30));
+  EXPECT_FALSE(srm.IsRangeCovered(10, 31));
+  EXPECT_TRUE(srm.IsContinious());
+
+  srm.AddRange(2, 50, RangeMap::kUnknownSize);
+  ASSERT_TRUE(srm.TryGetEntry(1000, &t, &sz));
+  EXPECT_EQ(2u, t);
+  EXPECT_EQ(RangeMap::kUnknownSize, sz);
+  EXPECT_FALSE(srm.IsContinious());
+
+  srm.AddRangeRel(3, 0, 10, 40);
+  EXPECT_TRUE(srm.IsRangeCovered(10, 1000));
+  // Unknown size entry is never continious, same as RangeMap
+  EXPECT_FALSE(srm.IsContinious());
+}
+
+TEST(ShardedRangeMapTest, SplitByHighBits) {
+  auto split_points = ShardedRangeMap::SplitByHighBits(2);
+  ASSERT_EQ(3u, split_points.size());
+  EXPECT_EQ(uint64_t(1) << 62, split_points[0]);
+  EXPECT_EQ(uint64_t(3) << 62, split_points[2]);
+  EXPECT_TRUE(ShardedRangeMap::SplitByHighBits(0).empty());
+}
+
+TEST(ShardedRangeMapTest, SameAsRangeMap) {
+  std::mt19937_64 rng(5);
+  for (int round = 0; round < 300; ++round) {
+    RangeMap rm;
+    ShardedRangeMap srm({10, 20, 25, 60, 61});
+    for (int i = 0; i < 12; ++i) {
+      uint64_t type = rng() % 3;
+      uint64_t addr = rng() % 80;
+      uint64_t size = (rng() % 6 == 0) ? RangeMap::kUnknownSize : rng() % 25;
+      rm.AddRange(type, addr, size);
+      srm.AddRange(type, addr, size);
+    }
+    AssertSameAnswers(rm, srm, 100);
+  }
+}
+
+TEST(ShardedRangeMapTest, DisjointWriters) {
+  // Each thread fills its own shard, the result is one continuous mapping
+  const uint64_t kShardSize = 1 << 16;
+  const uint64_t kStep = 16;
+  const size_t kThreads = 4;
+
+  std::vector<uint64_t> split_points;
+  for (size_t i = 1; i < kThreads; ++i) {
+    split_points.push_back(i * kShardSize);
+  }
+  ShardedRangeMap srm(split_points);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&srm, i]() {
+      for (uint64_t addr = i * kShardSize; addr < (i + 1) * kShardSize;
+           addr += kStep) {
+        srm.AddRange(addr / kStep % 2, addr, kStep);
+        uint64_t t, sz;
+        ASSERT_TRUE(srm.TryGetEntry(addr, &t, &sz));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(srm.IsContinious());
+  EXPECT_TRUE(srm.IsRangeCovered(0, kThreads * kShardSize));
+  EXPECT_FALSE(srm.IsRangeCovered(0, kThreads * kShardSize + 1));
+}
+
+TEST(ShardedRangeMapTest, WritersWithMovingTail) {
+  // Unknown size ranges go down through the last shard while other shards
+  // are written: the first one stays the tail, the rest fill gaps before it
+  const uint64_t kShardSize = 1 << 14;
+  const uint64_t kStep = 16;
+  const size_t kThreads = 3;
+
+  std::vector<uint64_t> split_points;
+  for (size_t i = 1; i <= kThreads; ++i) {
+    split_points.push_back(i * kShardSize);
+  }
+  ShardedRangeMap srm(split_points);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&srm, i]() {
+      for (uint64_t addr = i * kShardSize; addr < (i + 1) * kShardSize;
+           addr += kStep) {
+        srm.AddRange(1, addr, kStep);
+      }
+    });
+  }
+  threads.emplace_back([&srm]() {
+    for (uint64_t addr = (kThreads + 1) * kShardSize;
+         addr > kThreads * kShardSize; addr -= kStep) {
+      srm.AddRange(addr / kStep % 2, addr - kStep,
+                   ShardedRangeMap::kUnknownSize);
+      EXPECT_TRUE(srm.IsRangeCovered(addr - kStep, kShardSize));
+    }
+  });
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(srm.IsContinious());
+  EXPECT_TRUE(srm.IsRangeCovered(0, 2 * kThreads * kShardSize));
+  uint64_t t, sz;
+  ASSERT_TRUE(srm.TryGetEntry((kThreads + 1) * kShardSize, &t, &sz));
+  EXPECT_EQ(ShardedRangeMap::kUnknownSize, sz);
+  ASSERT_TRUE(srm.TryGetEntry(kThreads * kShardSize, &t, &sz));
+  EXPECT_NE(ShardedRangeMap::kUnknownSize, sz);
+}
+
+}  // namespace rangemap
@@ -0,0 +1,156 @@
+#include "rangemap.h"
+#include "stats.h"
+#include "gtest/gtest.h"
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace rangemap {
+
+namespace {
+
+uint64_t GetCallCount(stats::Op op) {
+  uint64_t count = 0;
+  for (size_t bucket = 0; bucket < stats::kBucketCount; ++bucket) {
+    count += stats::GetBucket(op, bucket);
+  }
+  return count;
+}
+
+}  // namespace
+
+// Passes with and without RANGEMAP_ENABLE_STATS, without it nothing is
+// counted
+TEST(StatsTest, Events) {
+  stats::Reset();
+  uint64_t on = stats::kIsEnabled ? 1 : 0;
+  RangeMap map;
+  map.AddRange(1, 0, 10);
+  map.AddRange(1, 20, 10);
+  // Joins both neighbours, the next one is moved to 10 first
+  map.AddRange(1, 10, 10);
+  ASSERT_EQ(1, std::distance(map.begin(), map.end()));
+  EXPECT_EQ(on, stats::GetCount(stats::kMergeNext));
+  EXPECT_EQ(on, stats::GetCount(stats::kMergePrev));
+  EXPECT_EQ(on, stats::GetCount(stats::kMergeBoth));
+  EXPECT_EQ(on, stats::GetCount(stats::kEntryMove));
+  EXPECT_EQ(3 * on, stats::GetCount(stats::kFixedSizeStep));
+  EXPECT_EQ(3 * on, GetCallCount(stats::kAddRange));
+
+  EXPECT_TRUE(map.IsRangeCovered(5, 20));
+  RangeMap::Cursor cursor(map);
+  EXPECT_TRUE(cursor.IsRangeCovered(5, 20));
+  EXPECT_EQ(on, GetCallCount(stats::kIsRangeCovered));
+  EXPECT_EQ(on, GetCallCount(stats::kCursorIsRangeCovered));
+  EXPECT_EQ(on, stats::GetCount(stats::kCursorCoverStep));
+  // IsRangeCovered goes through FindFirstUncovered, it is not counted twice
+  EXPECT_EQ(0u, GetCallCount(stats::kFindFirstUncovered));
+
+  map.RemoveRange(0, RangeMap::kUnknownSize);
+  EXPECT_EQ(on, stats::GetCount(stats::kEraseEntry));
+  EXPECT_EQ(on, GetCallCount(stats::kRemoveRange));
+
+  stats::Reset();
+  EXPECT_EQ(0u, stats::GetCount(stats::kMergeNext));
+  EXPECT_EQ(0u, GetCallCount(stats::kAddRange));
+}
+
+TEST(StatsTest, Buckets) {
+  // Recorded directly, works without RANGEMAP_ENABLE_STATS too
+  stats::Reset();
+  for (uint64_t ns : {0, 1, 2, 3, 4, 1024, 1025}) {
+    stats::Record(stats::kMerge, ns);
+  }
+  EXPECT_EQ(2u, stats::GetBucket(stats::kMerge, 0));
+  EXPECT_EQ(1u, stats::GetBucket(stats::kMerge, 1));
+  EXPECT_EQ(2u, stats::GetBucket(stats::kMerge, 2));
+  EXPECT_EQ(1u, stats::GetBucket(stats::kMerge, 10));
+  EXPECT_EQ(1u, stats::GetBucket(stats::kMerge, 11));
+  stats::Record(stats::kMerge, ~uint64_t(0));
+  EXPECT_EQ(1u, stats::GetBucket(stats::kMerge, stats::kBucketCount - 1));
+
+  // le is inclusive, exact powers of two are in their own bucket
+  std::string dump = DumpStats();
+  for (const char *line : {"{op=\"Merge\",le=\"1\"} 2\n",
+                           "{op=\"Merge\",le=\"2\"} 3\n",
+                           "{op=\"Merge\",le=\"4\"} 5\n",
+                           "{op=\"Merge\",le=\"512\"} 5\n",
+                           "{op=\"Merge\",le=\"1024\"} 6\n",
+                           "{op=\"Merge\",le=\"2048\"} 7\n",
+                           "{op=\"Merge\",le=\"70368744177664\"} 7\n",
+                           "{op=\"Merge\",le=\"+Inf\"} 8\n"}) {
+    EXPECT_NE(std::string::npos,
+              dump.find(std::string("rangemap_latency_ns_bucket") + line))
+        << line;
+  }
+  stats::Reset();
+}
+
+TEST(StatsTest, NestedCalls) {
+  // Merge into a map with unknown tail goes through AddRange, only Merge
+  // is timed. AddRanges takes the bulk path below the tail and AddRange
+  // after it.
+  RangeMap map;
+  map.AddRange(1, 100, RangeMap::kUnknownSize);
+  RangeMap other;
+  other.AddRange(2, 0, 10);
+  other.AddRange(2, 20, 10);
+  stats::Reset();
+  map.Merge(other);
+  std::vector<RangeMap::RangeSpec> specs = {{3, 40, 10}, {3, 150, 10}};
+  map.AddRanges(specs);
+  uint64_t on = stats::kIsEnabled ? 1 : 0;
+  EXPECT_EQ(on, GetCallCount(stats::kMerge));
+  EXPECT_EQ(on, GetCallCount(stats::kAddRanges));
+  EXPECT_EQ(0u, GetCallCount(stats::kAddRange));
+  EXPECT_EQ(4 * on, stats::GetCount(stats::kFixedSizeStep));
+}
+
+TEST(StatsTest, Queries) {
+  RangeMap map;
+  map.AddRange(1, 0, 10);
+  map.AddRange(2, 20, 10);
+  stats::Reset();
+  uint64_t on = stats::kIsEnabled ? 1 : 0;
+  uint64_t uncovered;
+  EXPECT_TRUE(map.FindFirstUncovered(0, 30, &uncovered));
+  RangeMap::Cursor cursor(map);
+  uint64_t type, size;
+  EXPECT_TRUE(cursor.TryGetEntry(5, &type, &size));
+  map.ForEachGap(0, 30, [](uint64_t, uint64_t) { return true; });
+  map.ForEachInRange(0, 30, [](uint64_t, uint64_t, size_t) { return true; });
+  EXPECT_FALSE(map.IsContinious());
+  EXPECT_EQ(on, GetCallCount(stats::kFindFirstUncovered));
+  EXPECT_EQ(on, GetCallCount(stats::kCursorTryGetEntry));
+  EXPECT_EQ(on, GetCallCount(stats::kForEachGap));
+  EXPECT_EQ(on, GetCallCount(stats::kForEachInRange));
+  EXPECT_EQ(on, GetCallCount(stats::kIsContinious));
+  EXPECT_EQ(0u, GetCallCount(stats::kTryGetEntry));
+  EXPECT_NE(std::string::npos,
+            DumpStats().find("rangemap_latency_ns_count{op=\"SaveTo\"} 0\n"));
+}
+
+TEST(StatsTest, Dump) {
+  stats::Reset();
+  RangeMap map;
+  map.AddRange(1, 0, 10);
+  map.AddRange(1, 10, 10);
+  std::string dump = DumpStats();
+  std::string merges = stats::kIsEnabled ? "1" : "0";
+  EXPECT_NE(std::string::npos,
+            dump.find("rangemap_events_total{event=\"merge_prev\"} " + merges +
+                      "\n"));
+  std::string calls = stats::kIsEnabled ? "2" : "0";
+  EXPECT_NE(std::string::npos,
+            dump.find("rangemap_latency_ns_bucket{op=\"AddRange\",le=\"+Inf\"} " +
+                      calls + "\n"));
+  EXPECT_NE(std::string::npos,
+            dump.find("rangemap_latency_ns_count{op=\"AddRange\"} " + calls +
+                      "\n"));
+  // Buckets are cumulative
+  EXPECT_NE(std::string::npos,
+            dump.find("rangemap_latency_ns_bucket{op=\"Merge\",le=\"1\"} 0\n"));
+  EXPECT_EQ('\n', dump.back());
+}
+
+}  // namespace rangemap